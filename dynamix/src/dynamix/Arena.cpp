@@ -0,0 +1,71 @@
+#include "Arena.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <new>
+
+namespace dynamix {
+
+	Arena::~Arena()
+	{
+		release();
+	}
+
+	std::string_view Arena::copy(std::string_view text)
+	{
+		char* chars = allocate_chars(text.size());
+		std::copy(text.begin(), text.end(), chars);
+		return std::string_view(chars, text.size());
+	}
+
+	char* Arena::allocate_chars(size_t count)
+	{
+		return (char*)allocate(std::max<size_t>(count, 1), 1);
+	}
+
+	void Arena::release()
+	{
+		for (void* chunk : m_Chunks) {
+			::operator delete(chunk);
+		}
+
+		m_Chunks.clear();
+		m_Current = nullptr;
+		m_End = nullptr;
+		m_NextChunkSize = FIRST_CHUNK_SIZE;
+	}
+
+	void* Arena::do_allocate(size_t bytes, size_t alignment)
+	{
+		uintptr_t start = ((uintptr_t)m_Current + alignment - 1) & ~(uintptr_t)(alignment - 1);
+		if (!m_Current || start + bytes > (uintptr_t)m_End) {
+			add_chunk(bytes + alignment);
+			start = ((uintptr_t)m_Current + alignment - 1) & ~(uintptr_t)(alignment - 1);
+		}
+
+		m_Current = (char*)(start + bytes);
+		return (void*)start;
+	}
+
+	void Arena::do_deallocate(void*, size_t, size_t)
+	{
+		// everything goes at once in `release`
+	}
+
+	bool Arena::do_is_equal(const std::pmr::memory_resource& other) const noexcept
+	{
+		return this == &other;
+	}
+
+	void Arena::add_chunk(size_t min_size)
+	{
+		size_t size = std::max(m_NextChunkSize, min_size);
+		m_NextChunkSize = std::min(m_NextChunkSize * 2, MAX_CHUNK_SIZE);
+
+		char* chunk = (char*)::operator new(size);
+		m_Chunks.push_back(chunk);
+		m_Current = chunk;
+		m_End = chunk + size;
+	}
+
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <memory_resource>
+#include <string_view>
+#include <vector>
+#include <cstddef>
+
+namespace dynamix {
+
+	// Bump pointer allocator for data that only lives while something is being
+	// compiled. Memory is taken from chunks that grow as they fill up, freeing a
+	// single allocation does nothing and `release` drops everything at once. It is
+	// a memory resource, so std::pmr containers can be kept in it too.
+	class Arena : public std::pmr::memory_resource
+	{
+	public:
+		static constexpr size_t FIRST_CHUNK_SIZE = 4 * 1024;
+		static constexpr size_t MAX_CHUNK_SIZE = 64 * 1024;
+
+		Arena() = default;
+		~Arena();
+
+		Arena(const Arena&) = delete;
+		Arena& operator=(const Arena&) = delete;
+
+		// the copy is not null terminated
+		std::string_view copy(std::string_view text);
+		char* allocate_chars(size_t count);
+
+		void release();
+
+	private:
+		void* do_allocate(size_t bytes, size_t alignment) override;
+		void do_deallocate(void*, size_t, size_t) override;
+		bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override;
+
+		void add_chunk(size_t min_size);
+
+	private:
+		std::vector<void*> m_Chunks;
+		char* m_Current = nullptr;
+		char* m_End = nullptr;
+		size_t m_NextChunkSize = FIRST_CHUNK_SIZE;
+	};
+
+}
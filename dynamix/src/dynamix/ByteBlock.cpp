@@ -19,4 +19,50 @@ namespace dynamix {
 		return (int32_t)(constants.size() - 1);
 	}
 
+	int32_t instruction_length(OpCode instruction)
+	{
+		switch (instruction) {
+			case OpCode::PushConstant:
+			case OpCode::DefineGlobal:
+			case OpCode::GetGlobal:
+			case OpCode::SetGlobal:
+			case OpCode::GetLocal:
+			case OpCode::SetLocal:
+			case OpCode::StoreLocalPop:
+			case OpCode::IncLocal:
+			case OpCode::GetUpvalue:
+			case OpCode::SetUpvalue:
+			case OpCode::Closure:
+			case OpCode::Call:
+			case OpCode::TailCall:
+				return 2;
+			case OpCode::Jmp:
+			case OpCode::Jz:
+			case OpCode::Loop:
+			case OpCode::JumpIfFalsePop:
+			case OpCode::JumpIfTruePop:
+				return 3;
+			case OpCode::PushConstantLong:
+			case OpCode::ClosureLong:
+			case OpCode::DefineGlobalLong:
+			case OpCode::GetGlobalLong:
+			case OpCode::SetGlobalLong:
+			case OpCode::GetLocalLong:
+			case OpCode::SetLocalLong:
+			case OpCode::JmpLong:
+			case OpCode::JzLong:
+			case OpCode::LoopLong:
+			case OpCode::JumpIfFalsePopLong:
+			case OpCode::JumpIfTruePopLong:
+				return 4;
+			case OpCode::JumpIfNotLess:
+			case OpCode::JumpIfNotGreater:
+			case OpCode::JumpIfLess:
+			case OpCode::JumpIfGreater:
+				return 5;
+			default:
+				return 1;
+		}
+	}
+
 }
@@ -5,11 +5,15 @@
 #include <vector>
 #include <cstdint>
 
+// Largest operand of the `Long` instruction forms, which use 24 bits instead of 8 or 16.
+#define UINT24_MAX 0xffffff
+
 namespace dynamix {
 
 	enum class OpCode : uint8_t
 	{
 		PushConstant,
+		PushConstantLong,
 		Pop,
 		Null,
 		True,
@@ -17,22 +21,91 @@ namespace dynamix {
 		Equal,
 		Greater,
 		Less,
+		NotEqual,
+		GreaterEqual,
+		LessEqual,
 		Add,
 		Sub,
 		Div,
 		Mul,
+		Mod,
+		BitAnd,
+		BitOr,
+		BitXor,
+		ShiftLeft,
+		ShiftRight,
 		Negate,
 		Not,
 		Jmp,
+		JmpLong,
 		Jz,
+		JzLong,
 		Loop,
+		LoopLong,
+		JumpIfFalsePop,
+		JumpIfFalsePopLong,
+		JumpIfTruePop,
+		JumpIfTruePopLong,
+		JumpIfNotLess,
+		JumpIfNotGreater,
+		JumpIfLess,
+		JumpIfGreater,
 		DefineGlobal,
+		DefineGlobalLong,
 		GetGlobal,
+		GetGlobalLong,
 		SetGlobal,
+		SetGlobalLong,
 		GetLocal,
+		GetLocalLong,
 		SetLocal,
+		SetLocalLong,
+		StoreLocalPop,
+		GetUpvalue,
+		SetUpvalue,
+		CloseUpvalue,
+		Closure,
+		ClosureLong,
 		Print,
+		Call,
+		TailCall,
 		Return,
+
+		// Forms the compiler emits when it proved both operands are numbers. They
+		// skip the operand check.
+		GreaterUnchecked,
+		LessUnchecked,
+		GreaterEqualUnchecked,
+		LessEqualUnchecked,
+		AddUnchecked,
+		SubUnchecked,
+		DivUnchecked,
+		MulUnchecked,
+
+		// Operand-free forms the peephole pass rewrites the most common loads and
+		// stores into. IncLocal adds 1 to a local the compiler proved is a number.
+		PushZero,
+		PushOne,
+		GetLocal0,
+		GetLocal1,
+		GetLocal2,
+		GetLocal3,
+		SetLocal0,
+		SetLocal1,
+		SetLocal2,
+		SetLocal3,
+		IncLocal,
+
+		// Forms the interpreter rewrites an instruction into once its operands were
+		// both numbers. The compiler never emits them.
+		GreaterNumNum,
+		LessNumNum,
+		GreaterEqualNumNum,
+		LessEqualNumNum,
+		AddNumNum,
+		SubNumNum,
+		DivNumNum,
+		MulNumNum,
 	};
 
 	struct ByteBlock
@@ -50,4 +123,7 @@ namespace dynamix {
 		int32_t add_constant(Value value);
 	};
 
+	// Size in bytes of an instruction, including its operands.
+	int32_t instruction_length(OpCode instruction);
+
 }
@@ -3,101 +3,191 @@
 #include "dynamix.h"
 #include "Object.h"
 #include "Disassembler.h"
+#include "Peephole.h"
+#include "Ir.h"
+#include "PassManager.h"
 
 #include <format>
+#include <optional>
+#include <algorithm>
+#include <charconv>
+#include <iterator>
 
 namespace dynamix {
 
-#define LOCAL_CAPACITY 256
-
-	using namespace std::placeholders;
-#define BIND_FN(fn) [this](auto&&... args) -> decltype(auto) { return this->fn(std::forward<decltype(args)>(args)...); }
-
-	Compiler::Compiler(const std::string& filename, const std::string& source)
-		: m_Filename(filename), m_Lexer(source), m_Parser(), m_ParseRules(
-		{
-			{ TokenType::LParen,    ParseRule{ BIND_FN(grouping),  nullptr,         Precedence::None } },
-			{ TokenType::RParen,    ParseRule{ nullptr,            nullptr,         Precedence::None } },
-			{ TokenType::LBracket,  ParseRule{ nullptr,            nullptr,         Precedence::None } },
-			{ TokenType::RBracket,  ParseRule{ nullptr,            nullptr,         Precedence::None } },
-			{ TokenType::Comma,     ParseRule{ nullptr,            nullptr,         Precedence::None } },
-			{ TokenType::Dot,       ParseRule{ nullptr,            nullptr,         Precedence::None } },
-			{ TokenType::Minus,     ParseRule{ BIND_FN(unary),     BIND_FN(binary), Precedence::Term } },
-			{ TokenType::Plus,      ParseRule{ nullptr,            BIND_FN(binary), Precedence::Term } },
-			{ TokenType::Semicolon, ParseRule{ nullptr,            nullptr,         Precedence::None } },
-			{ TokenType::Slash,     ParseRule{ nullptr,            BIND_FN(binary), Precedence::Factor } },
-			{ TokenType::Star,      ParseRule{ nullptr,            BIND_FN(binary), Precedence::Factor } },
-			{ TokenType::Bang,      ParseRule{ BIND_FN(unary),     nullptr,         Precedence::None } },
-			{ TokenType::BangEq,    ParseRule{ nullptr,            BIND_FN(binary), Precedence::Equality } },
-			{ TokenType::Eq,        ParseRule{ nullptr,            nullptr,         Precedence::None } },
-			{ TokenType::EqEq,      ParseRule{ nullptr,            BIND_FN(binary), Precedence::Equality } },
-			{ TokenType::Gt,        ParseRule{ nullptr,            BIND_FN(binary), Precedence::Comparison } },
-			{ TokenType::Gte,       ParseRule{ nullptr,            BIND_FN(binary), Precedence::Comparison } },
-			{ TokenType::Lt,        ParseRule{ nullptr,            BIND_FN(binary), Precedence::Comparison } },
-			{ TokenType::Lte,       ParseRule{ nullptr,            BIND_FN(binary), Precedence::Comparison } },
-			{ TokenType::Ident,     ParseRule{ BIND_FN(variable),  nullptr,         Precedence::None}},
-			{ TokenType::String,    ParseRule{ BIND_FN(string),    nullptr,         Precedence::None}},
-			{ TokenType::Number,    ParseRule{ BIND_FN(number),    nullptr,         Precedence::None } },
-			{ TokenType::Char,      ParseRule{ BIND_FN(character), nullptr,         Precedence::None } },
-			{ TokenType::And,       ParseRule{ nullptr,            BIND_FN(and_),   Precedence::And } },
-			{ TokenType::Struct,    ParseRule{ nullptr,            nullptr,         Precedence::None } },
-			{ TokenType::Else,      ParseRule{ nullptr,            nullptr,         Precedence::None } },
-			{ TokenType::False,     ParseRule{ BIND_FN(literal),   nullptr,         Precedence::None } },
-			{ TokenType::For,       ParseRule{ nullptr,            nullptr,         Precedence::None } },
-			{ TokenType::Fun,       ParseRule{ nullptr,            nullptr,         Precedence::None } },
-			{ TokenType::If,        ParseRule{ nullptr,            nullptr,         Precedence::None } },
-			{ TokenType::Null,      ParseRule{ BIND_FN(literal),   nullptr,         Precedence::None } },
-			{ TokenType::Or,        ParseRule{ nullptr,            BIND_FN(or_),    Precedence::Or } },
-			{ TokenType::Print,     ParseRule{ nullptr,            nullptr,         Precedence::None } },
-			{ TokenType::Return,    ParseRule{ nullptr,            nullptr,         Precedence::None } },
-			{ TokenType::Super,     ParseRule{ nullptr,            nullptr,         Precedence::None } },
-			{ TokenType::Self,      ParseRule{ nullptr,            nullptr,         Precedence::None } },
-			{ TokenType::True,      ParseRule{ BIND_FN(literal),   nullptr,         Precedence::None } },
-			{ TokenType::Let,       ParseRule{ nullptr,            nullptr,         Precedence::None } },
-			{ TokenType::While,     ParseRule{ nullptr,            nullptr,         Precedence::None } },
-			{ TokenType::Error,     ParseRule{ nullptr,            nullptr,         Precedence::None } },
-			{ TokenType::Eof,       ParseRule{ nullptr,            nullptr,         Precedence::None } },
-		}
-	)
-	{
-		m_Function = nullptr;
-		m_Type = FunctionType::Script;
-
-		m_Locals.reserve(LOCAL_CAPACITY);
-		m_ScopeDepth = 0;
-
-		m_Function = new ObjFunction();
-		m_Function->arity = 0;
-		m_Function->block = ByteBlock();
-		m_Function->name = "";
-		((Obj*)m_Function)->type = ObjType::Function;
-
-		Local local;
-		local.depth = 0;
-		local.name.start = "";
-		local.name.length = 0;
-		m_Locals.push(local);
+	// indexed by token type, see get_rule
+	constexpr ParseRule Compiler::s_ParseRules[] = {
+		{ TokenType::LParen,    &Compiler::grouping,   &Compiler::call,    Precedence::Call },
+		{ TokenType::RParen,    nullptr,               nullptr,            Precedence::None },
+		{ TokenType::LBracket,  nullptr,               nullptr,            Precedence::None },
+		{ TokenType::RBracket,  nullptr,               nullptr,            Precedence::None },
+		{ TokenType::Comma,     nullptr,               nullptr,            Precedence::None },
+		{ TokenType::Dot,       nullptr,               nullptr,            Precedence::None },
+		{ TokenType::Minus,     &Compiler::unary,      &Compiler::binary,  Precedence::Term },
+		{ TokenType::Plus,      nullptr,               &Compiler::binary,  Precedence::Term },
+		{ TokenType::Semicolon, nullptr,               nullptr,            Precedence::None },
+		{ TokenType::Slash,     nullptr,               &Compiler::binary,  Precedence::Factor },
+		{ TokenType::Star,      nullptr,               &Compiler::binary,  Precedence::Factor },
+		{ TokenType::Percent,   nullptr,               &Compiler::binary,  Precedence::Factor },
+		{ TokenType::Caret,     nullptr,               &Compiler::binary,  Precedence::BitXor },
+		{ TokenType::Bang,      &Compiler::unary,      nullptr,            Precedence::None },
+		{ TokenType::BangEq,    nullptr,               &Compiler::binary,  Precedence::Equality },
+		{ TokenType::Eq,        nullptr,               nullptr,            Precedence::None },
+		{ TokenType::EqEq,      nullptr,               &Compiler::binary,  Precedence::Equality },
+		{ TokenType::Gt,        nullptr,               &Compiler::binary,  Precedence::Comparison },
+		{ TokenType::Gte,       nullptr,               &Compiler::binary,  Precedence::Comparison },
+		{ TokenType::GtGt,      nullptr,               &Compiler::binary,  Precedence::Shift },
+		{ TokenType::Lt,        nullptr,               &Compiler::binary,  Precedence::Comparison },
+		{ TokenType::Lte,       nullptr,               &Compiler::binary,  Precedence::Comparison },
+		{ TokenType::LtLt,      nullptr,               &Compiler::binary,  Precedence::Shift },
+		{ TokenType::Amp,       nullptr,               &Compiler::binary,  Precedence::BitAnd },
+		{ TokenType::And,       nullptr,               &Compiler::and_,    Precedence::And },
+		{ TokenType::Pipe,      nullptr,               &Compiler::binary,  Precedence::BitOr },
+		{ TokenType::Or,        nullptr,               &Compiler::or_,     Precedence::Or },
+		{ TokenType::Ident,     &Compiler::variable,   nullptr,            Precedence::None },
+		{ TokenType::String,    &Compiler::string,     nullptr,            Precedence::None },
+		{ TokenType::Number,    &Compiler::number,     nullptr,            Precedence::None },
+		{ TokenType::Char,      &Compiler::character,  nullptr,            Precedence::None },
+		{ TokenType::Struct,    nullptr,               nullptr,            Precedence::None },
+		{ TokenType::Else,      nullptr,               nullptr,            Precedence::None },
+		{ TokenType::False,     &Compiler::literal,    nullptr,            Precedence::None },
+		{ TokenType::For,       nullptr,               nullptr,            Precedence::None },
+		{ TokenType::Fun,       nullptr,               nullptr,            Precedence::None },
+		{ TokenType::If,        nullptr,               nullptr,            Precedence::None },
+		{ TokenType::Null,      &Compiler::literal,    nullptr,            Precedence::None },
+		{ TokenType::Print,     nullptr,               nullptr,            Precedence::None },
+		{ TokenType::Return,    nullptr,               nullptr,            Precedence::None },
+		{ TokenType::Super,     nullptr,               nullptr,            Precedence::None },
+		{ TokenType::Self,      nullptr,               nullptr,            Precedence::None },
+		{ TokenType::True,      &Compiler::literal,    nullptr,            Precedence::None },
+		{ TokenType::Let,       nullptr,               nullptr,            Precedence::None },
+		{ TokenType::While,     nullptr,               nullptr,            Precedence::None },
+		{ TokenType::Error,     nullptr,               nullptr,            Precedence::None },
+		{ TokenType::Eof,       nullptr,               nullptr,            Precedence::None },
+	};
+
+	Compiler::Compiler(const std::string& filename, const std::string& source, Heap& heap, Globals& globals, const CompilerOptions& options)
+		: m_Filename(filename), m_Options(options), m_Heap(heap), m_Globals(globals), m_Lexer(source, m_Arena), m_Parser(), m_Functions(&m_Arena), m_LoopTypes(&m_Arena)
+	{
+		reset();
 	}
 
 	ObjFunction* Compiler::compile()
+	{
+		compile_script();
+
+		if (m_JumpOverflow && !m_Parser.had_error) {
+			reset();
+			m_WideJumps = true;
+			compile_script();
+		}
+
+		if (m_Parser.had_error) {
+			release_arena();
+			return nullptr;
+		}
+
+		PassManager passes = PassManager::for_level(m_Options.optimization_level);
+
+		// functions are finished innermost first, so the script is always the last one
+		for (ObjFunction* function : m_Functions) {
+			if (m_Options.peephole) {
+				Peephole::optimize(&function->block);
+			}
+
+			if (m_Options.backend == Backend::Register) {
+				IrFunction ir = IrFunction::lift(function);
+				passes.run(&ir);
+				ir.lower(&function->registers);
+			}
+			else {
+				function->decoded = DecodedBlock::decode(&function->block, function->arity);
+			}
+
+#if DEBUG_DISASSEMBLE_CODE
+			const char* name = function->name.empty() ? "<script>" : function->name.c_str();
+			if (m_Options.backend == Backend::Register) {
+				Disassembler::disassemble_registers(&function->registers, &function->block, name);
+			}
+			else {
+				Disassembler::disassemble_block(&function->block, name);
+			}
+#endif
+		}
+
+		ObjFunction* script = m_Functions.back();
+		release_arena();
+		return script;
+	}
+
+	void Compiler::reset()
+	{
+		release_arena();
+		m_Lexer.reset();
+		m_Parser = Parser();
+
+		m_Condition = nullptr;
+		m_ExpressionDepth = 0;
+		m_ExpressionType = StaticType::Unknown;
+		m_JumpOverflow = false;
+
+		m_Scope = nullptr;
+		m_ScriptScope.emplace(&m_Arena);
+		begin_function(&*m_ScriptScope, FunctionType::Script);
+	}
+
+	void Compiler::release_arena()
+	{
+		// nothing may keep pointing into the arena once it is released
+		m_Functions = std::pmr::vector<ObjFunction*>(&m_Arena);
+		m_LoopTypes = std::pmr::unordered_map<const char*, LocalTypes>(&m_Arena);
+		m_ScriptScope.reset();
+		m_Scope = nullptr;
+		m_Arena.release();
+	}
+
+	void Compiler::compile_script()
 	{
 		advance();
-		
+
 		while (!match(TokenType::Eof)) {
 			declaration();
 		}
 
 		consume(TokenType::Eof, "expected end of expression");
-		push_return();
+		end_function();
+	}
 
-#if DEBUG_DISASSEMBLE_CODE
-		if (!m_Parser.had_error) {
-			ByteBlock block = current_byte_block();
-			Disassembler::disassemble_block(&block, (m_Function->name.empty() ? "<script>" : m_Function->name.c_str()));
+	void Compiler::begin_function(FunctionScope* scope, FunctionType type)
+	{
+		scope->enclosing = m_Scope;
+		scope->type = type;
+		scope->function = m_Heap.new_function();
+		scope->locals.reserve(LOCAL_RESERVE);
+
+		if (type != FunctionType::Script) {
+			scope->function->name = std::string(m_Parser.previous.start, m_Parser.previous.length);
 		}
-#endif
 
-		return m_Parser.had_error ? nullptr : m_Function;
+		// slot 0 of every frame holds the function being called
+		Local local;
+		local.depth = 0;
+		local.name.start = "";
+		local.name.length = 0;
+		scope->locals.push(local);
+
+		m_Scope = scope;
+	}
+
+	ObjFunction* Compiler::end_function()
+	{
+		push_return();
+
+		ObjFunction* function = m_Scope->function;
+		m_Functions.push_back(function);
+
+		m_Scope = m_Scope->enclosing;
+		return function;
 	}
 
 	const std::string& Compiler::get_last_error() const
@@ -115,12 +205,7 @@ namespace dynamix {
 			if (m_Parser.current.type != TokenType::Error)
 				break;
 
-			std::string err(m_Parser.current.start, (size_t)m_Parser.current.length);
-			err.push_back('\0');
-			error_at_current(err);
-
-			// we can drop the error now
-			free((char*)m_Parser.current.start);
+			error_at_current(std::string_view(m_Parser.current.start, m_Parser.current.length));
 		}
 
 		return m_Parser.current;
@@ -142,18 +227,11 @@ namespace dynamix {
 
 	void Compiler::function(FunctionType type)
 	{
+		FunctionScope scope(&m_Arena);
+		begin_function(&scope, type);
 		begin_scope();
 
-		ObjFunction* fun = new ObjFunction();
-		fun->arity = 0;
-		fun->block = ByteBlock();
-		fun->name = "";
-
-		if (type != FunctionType::Script) {
-			std::string fun_name(m_Parser.previous.start, m_Parser.previous.length);
-			fun_name.push_back('\0');
-			fun->name = fun_name;
-		}
+		ObjFunction* fun = m_Scope->function;
 
 		consume(TokenType::LParen, "expected '(' after identifier");
 		if (!check(TokenType::RParen)) {
@@ -162,7 +240,7 @@ namespace dynamix {
 				if (fun->arity > 255) {
 					error_at_current("cannot have more than 255 parameters");
 				}
-				uint8_t constant = parse_variable("expected variable name");
+				uint32_t constant = parse_variable("expected variable name");
 				define_variable(constant);
 			} while (match(TokenType::Comma));
 		}
@@ -176,11 +254,16 @@ namespace dynamix {
 			statement();
 		}
 
-		((Obj*)fun)->type = ObjType::Function;
-
-		push_bytes((uint8_t)OpCode::PushConstant, make_constant(Value((Obj*)fun)));
+		// the frame is discarded on return, so the parameters and locals need no pops
+		end_function();
 
-		end_scope();
+		// functions that capture nothing are used as is, without a closure
+		if (fun->captures.empty()) {
+			push_constant(Value((Obj*)fun));
+		}
+		else {
+			push_indexed(OpCode::Closure, OpCode::ClosureLong, make_constant(Value((Obj*)fun)));
+		}
 	}
 
 	void Compiler::statement()
@@ -202,6 +285,9 @@ namespace dynamix {
 		else if (match(TokenType::For)) {
 			for_statement();
 		}
+		else if (match(TokenType::Return)) {
+			return_statement();
+		}
 		else {
 			expression_statement();
 		}
@@ -221,47 +307,152 @@ namespace dynamix {
 		push_byte((uint8_t)OpCode::Print);
 	}
 
-	void Compiler::if_statement()
+	void Compiler::return_statement()
 	{
+		if (m_Scope->type == FunctionType::Script) {
+			error("cannot return from top-level code");
+		}
+
+		if (match(TokenType::Semicolon)) {
+			push_return();
+			return;
+		}
+
 		expression();
+		consume(TokenType::Semicolon, "expected ';' after return value");
 
-		int32_t then_jump = push_jump((uint8_t)OpCode::Jz);
-		push_byte((uint8_t)OpCode::Pop);
-		if (match(TokenType::LBracket)) {
-			begin_scope();
-			block();
-			end_scope();
+		// a call whose result is returned as is can reuse the returning frame
+		ByteBlock& block = current_byte_block();
+		int32_t call = m_Scope->last_call;
+		if (call >= 0 && call == (int32_t)block.bytes.size() - 2 && (OpCode)block.bytes[call] == OpCode::Call) {
+			block.bytes[call] = (uint8_t)OpCode::TailCall;
+		}
+
+		push_byte((uint8_t)OpCode::Return);
+	}
+
+	void Compiler::if_statement()
+	{
+		Condition branch = condition();
+
+		if (branch.constant) {
+			// the branch is decided at compile time, only the taken side is kept
+			branch_body(*branch.constant);
+			if (match(TokenType::Else)) {
+				branch_body(!*branch.constant);
+			}
+
+			return;
+		}
+
+		LocalTypes types = local_types();
+		branch_body(true);
+
+		if (match(TokenType::Else)) {
+			int32_t else_jump = push_jump((uint8_t)OpCode::Jmp);
+			patch_jumps(branch.false_jumps);
+
+			LocalTypes then_types = local_types();
+			set_local_types(types);
+			branch_body(true);
+			patch_jump(else_jump);
+
+			join_local_types(then_types);
 		}
 		else {
-			statement();
+			patch_jumps(branch.false_jumps);
+			join_local_types(types);
 		}
+	}
 
-		int32_t else_jump = push_jump((uint8_t)OpCode::Jmp);
+	void Compiler::while_statement()
+	{
+		typed_loop([this]() {
+			int32_t loop_start = current_byte_block().bytes.size();
+			Condition loop = condition();
 
-		patch_jump(then_jump);
-		push_byte((uint8_t)OpCode::Pop);
+			LocalTypes exit_types = local_types();
 
-		if (match(TokenType::Else)) {
-			if (match(TokenType::LBracket)) {
-				begin_scope();
-				block();
-				end_scope();
+			if (loop.constant) {
+				branch_body(*loop.constant);
+				if (*loop.constant) {
+					push_loop(loop_start);
+				}
+
+				return exit_types;
 			}
-			else {
-				statement();
+
+			branch_body(true);
+			push_loop(loop_start);
+
+			patch_jumps(loop.false_jumps);
+			return exit_types;
+		});
+	}
+
+	template <typename CompileLoop>
+	void Compiler::typed_loop(const CompileLoop& compile_loop)
+	{
+		Lexer::Checkpoint checkpoint = m_Lexer.checkpoint();
+		Token previous = m_Parser.previous;
+		Token current = m_Parser.current;
+		int32_t start = (int32_t)current_byte_block().bytes.size();
+		size_t constant_count = current_byte_block().constants.size();
+		size_t function_count = m_Functions.size();
+
+		// the types a loop converges to only get weaker when it is entered with weaker
+		// ones, so it can start from what it was solved for last time
+		auto solved = m_LoopTypes.find(checkpoint.current);
+		if (solved != m_LoopTypes.end() && solved->second.size() == m_Scope->locals.size()) {
+			join_local_types(solved->second);
+		}
+
+		for (uint32_t pass = 1;; pass++) {
+			LocalTypes entry_types = local_types();
+			std::pmr::vector<uint32_t> stores(&m_Arena);
+			for (size_t i = 0; i < entry_types.size(); i++) {
+				stores.push_back(m_Scope->locals[i].stores);
 			}
-		}
 
-		patch_jump(else_jump);
+			LocalTypes exit_types = compile_loop();
+
+			// the end of the body runs before the top of the loop again, so whatever it
+			// leaves has to agree with what the top was compiled for
+			LocalTypes back_edge_types = local_types();
+			set_local_types(entry_types);
+			join_local_types(back_edge_types);
+
+			if (m_Parser.had_error || local_types() == entry_types) {
+				m_LoopTypes.insert_or_assign(checkpoint.current, entry_types);
+				set_local_types(exit_types);
+				return;
+			}
+
+			// compile it again, assuming less. A chain of assignments can take a pass per
+			// link to settle, so after the third pass nothing is assumed about the locals
+			// the body assigns, and after the fourth about any of them
+			LocalTypes joined_types = local_types();
+			for (size_t i = 0; i < joined_types.size() && pass >= 3; i++) {
+				if (pass >= 4 || i >= stores.size() || m_Scope->locals[i].stores != stores[i]) {
+					joined_types[i] = StaticType::Unknown;
+				}
+			}
+			discard_code(start, constant_count);
+			m_Functions.resize(function_count);
+
+			m_Lexer.rewind(checkpoint);
+			m_Parser.previous = previous;
+			m_Parser.current = current;
+			set_local_types(joined_types);
+		}
 	}
 
-	void Compiler::while_statement()
+	void Compiler::branch_body(bool reachable)
 	{
-		int32_t loop_start = current_byte_block().bytes.size();
-		expression();
+		int32_t start = (int32_t)current_byte_block().bytes.size();
+		size_t constant_count = current_byte_block().constants.size();
+		LocalTypes types = local_types();
 
-		int32_t exit_jump = push_jump((uint8_t)OpCode::Jz);
-		push_byte((uint8_t)OpCode::Pop);
 		if (match(TokenType::LBracket)) {
 			begin_scope();
 			block();
@@ -271,10 +462,80 @@ namespace dynamix {
 			statement();
 		}
 
-		push_loop(loop_start);
+		// unreachable code is still parsed for errors, but never emitted
+		if (!reachable) {
+			discard_code(start, constant_count);
+			set_local_types(types);
+		}
+	}
+
+	Condition Compiler::condition()
+	{
+		Condition condition(&m_Arena);
+		condition.depth = m_ExpressionDepth + 1;
+		condition.operand_start = (int32_t)current_byte_block().bytes.size();
+
+		// the operands of && and || in `if (a && b)` can jump out of the condition
+		// too, as long as nothing follows the group
+		bool grouped = is_grouped_condition();
+		if (grouped) {
+			advance();
+		}
 
-		patch_jump(exit_jump);
-		push_byte((uint8_t)OpCode::Pop);
+		Condition* enclosing = m_Condition;
+		m_Condition = &condition;
+		expression();
+		m_Condition = enclosing;
+
+		if (grouped) {
+			consume(TokenType::RParen, "expected ')' after condition");
+		}
+
+		const Literal* literal = literal_at(condition.operand_start);
+		if (literal && condition.false_jumps.empty() && condition.true_jumps.empty()) {
+			condition.constant = !literal->value.is_falsey();
+			discard_code(condition.operand_start, literal->constant_count);
+			return condition;
+		}
+
+		condition.false_jumps.push_back(push_jump_if_false(condition.operand_start));
+		patch_jumps(condition.true_jumps);
+		condition.true_jumps.clear();
+
+		return condition;
+	}
+
+	bool Compiler::is_grouped_condition()
+	{
+		if (!check(TokenType::LParen)) {
+			return false;
+		}
+
+		Lexer::Checkpoint checkpoint = m_Lexer.checkpoint();
+		Token previous = m_Parser.previous;
+		Token current = m_Parser.current;
+
+		// find the closing parenthesis and look at what comes after it
+		for (uint32_t depth = 0; !check(TokenType::Eof);) {
+			if (check(TokenType::LParen)) {
+				depth++;
+			}
+			else if (check(TokenType::RParen) && --depth == 0) {
+				break;
+			}
+
+			advance();
+		}
+
+		bool grouped = false;
+		if (match(TokenType::RParen)) {
+			grouped = get_rule(m_Parser.current.type).infix == nullptr;
+		}
+
+		m_Lexer.rewind(checkpoint);
+		m_Parser.previous = previous;
+		m_Parser.current = current;
+		return grouped;
 	}
 
 	void Compiler::for_statement()
@@ -291,41 +552,63 @@ namespace dynamix {
 			expression_statement();
 		}
 
-		int32_t loop_start = current_byte_block().bytes.size();
-		int32_t exit_jump = -1;
-		if (!match(TokenType::Semicolon)) {
-			expression();
-			consume(TokenType::Semicolon, "expected ';' after loop condition");
+		typed_loop([this]() {
+			int32_t loop_start = current_byte_block().bytes.size();
+			size_t loop_constants = current_byte_block().constants.size();
+			Condition loop(&m_Arena);
+			if (!match(TokenType::Semicolon)) {
+				loop = condition();
+				consume(TokenType::Semicolon, "expected ';' after loop condition");
+			}
 
-			exit_jump = push_jump((uint8_t)OpCode::Jz);
-			push_byte((uint8_t)OpCode::Pop);
-		}
+			LocalTypes exit_types = local_types();
 
-		if (!match(TokenType::RParen)) {
-			int32_t body_jump = push_jump((uint8_t)OpCode::Jmp);
-			int32_t increment_start = current_byte_block().bytes.size();
-			expression();
-			push_byte((uint8_t)OpCode::Pop);
+			// the increment is compiled after the body, so every iteration is a single
+			// run from the condition to the jump back to it
+			bool has_increment = !check(TokenType::RParen);
+			Lexer::Checkpoint increment = m_Lexer.checkpoint();
+			Token increment_start = m_Parser.current;
+			for (uint32_t depth = 0; !check(TokenType::Eof) && (depth > 0 || !check(TokenType::RParen));) {
+				if (check(TokenType::LParen)) {
+					depth++;
+				}
+				else if (check(TokenType::RParen)) {
+					depth--;
+				}
+
+				advance();
+			}
 			consume(TokenType::RParen, "expected ')'");
 
+			// locals of the body go out of scope before the increment
+			statement();
+
+			if (has_increment) {
+				Lexer::Checkpoint body_end = m_Lexer.checkpoint();
+				Token previous = m_Parser.previous;
+				Token current = m_Parser.current;
+
+				m_Lexer.rewind(increment);
+				m_Parser.current = increment_start;
+				expression();
+				push_byte((uint8_t)OpCode::Pop);
+
+				m_Lexer.rewind(body_end);
+				m_Parser.previous = previous;
+				m_Parser.current = current;
+			}
+
 			push_loop(loop_start);
-			loop_start = increment_start;
-			patch_jump(body_jump);
-		}
+			patch_jumps(loop.false_jumps);
 
-		if (match(TokenType::LBracket)) {
-			block();
-		}
-		else {
-			statement();
-		}
+			// a constant false condition never enters the loop
+			if (loop.constant && !*loop.constant) {
+				discard_code(loop_start, loop_constants);
+				set_local_types(exit_types);
+			}
 
-		push_loop(loop_start);
-		
-		if (exit_jump != -1) {
-			patch_jump(exit_jump);
-			push_byte((uint8_t)OpCode::Pop);
-		}
+			return exit_types;
+		});
 
 		end_scope();
 	}
@@ -349,10 +632,12 @@ namespace dynamix {
 
 	void Compiler::let_declaration()
 	{
-		uint8_t global = parse_variable("expected identifier");
+		uint32_t global = parse_variable("expected identifier");
 
+		StaticType type = StaticType::Unknown;
 		if (match(TokenType::Eq)) {
 			expression();
+			type = m_ExpressionType;
 		}
 		else {
 			push_byte((uint8_t)OpCode::Null);
@@ -360,12 +645,16 @@ namespace dynamix {
 
 		consume(TokenType::Semicolon, "expected ';' after expression");
 
+		if (m_Scope->scope_depth > 0) {
+			m_Scope->locals[m_Scope->locals.size() - 1].type = type;
+		}
+
 		define_variable(global);
 	}
 
 	void Compiler::fun_declaration()
 	{
-		uint8_t global = parse_variable("expected function name");
+		uint32_t global = parse_variable("expected function name");
 		mark_initialized();
 		function(FunctionType::Function);
 		define_variable(global);
@@ -398,7 +687,7 @@ namespace dynamix {
 		}
 	}
 
-	void Compiler::consume(TokenType expected, const std::string& msg)
+	void Compiler::consume(TokenType expected, std::string_view msg)
 	{
 		if (!check(expected)) {
 			error_at_current(msg);
@@ -436,76 +725,367 @@ namespace dynamix {
 
 	void Compiler::push_loop(int32_t loop_start)
 	{
-		push_byte((uint8_t)OpCode::Loop);
+		// backward distances are known up front, so the short form is used whenever it fits
+		int32_t offset = current_byte_block().bytes.size() - loop_start + 3;
+		if (offset <= UINT16_MAX) {
+			push_byte((uint8_t)OpCode::Loop);
+			push_byte((offset >> 8) & 0xff);
+			push_byte(offset & 0xff);
+			return;
+		}
 
-		int32_t offset = current_byte_block().bytes.size() - loop_start + 2;
-		if (offset > UINT16_MAX) {
+		offset++;
+		if (offset > UINT24_MAX) {
 			error("Loop body too large");
 		}
 
+		push_byte((uint8_t)OpCode::LoopLong);
+		push_byte((offset >> 16) & 0xff);
 		push_byte((offset >> 8) & 0xff);
 		push_byte(offset & 0xff);
 	}
 
 	int32_t Compiler::push_jump(uint8_t instruction)
 	{
+		if (!m_WideJumps) {
+			push_byte(instruction);
+			push_byte(0xff);
+			push_byte(0xff);
+			return (int32_t)current_byte_block().bytes.size() - 2;
+		}
+
+		switch ((OpCode)instruction) {
+			case OpCode::Jmp:            instruction = (uint8_t)OpCode::JmpLong;            break;
+			case OpCode::Jz:             instruction = (uint8_t)OpCode::JzLong;             break;
+			case OpCode::JumpIfFalsePop: instruction = (uint8_t)OpCode::JumpIfFalsePopLong; break;
+			case OpCode::JumpIfTruePop:  instruction = (uint8_t)OpCode::JumpIfTruePopLong;  break;
+			default:
+				break;
+		}
+
 		push_byte(instruction);
 		push_byte(0xff);
 		push_byte(0xff);
-		return (int32_t)current_byte_block().bytes.size() - 2;
+		push_byte(0xff);
+		return (int32_t)current_byte_block().bytes.size() - 3;
+	}
+
+	void Compiler::push_indexed(OpCode instruction, OpCode long_instruction, uint32_t index)
+	{
+		if (index <= UINT8_MAX) {
+			push_bytes((uint8_t)instruction, (uint8_t)index);
+			return;
+		}
+
+		push_byte((uint8_t)long_instruction);
+		push_byte((index >> 16) & 0xff);
+		push_byte((index >> 8) & 0xff);
+		push_byte(index & 0xff);
 	}
 
 	void Compiler::push_constant(Value value)
 	{
-		push_bytes((uint8_t)OpCode::PushConstant, make_constant(value));
+		push_indexed(OpCode::PushConstant, OpCode::PushConstantLong, make_constant(value));
 	}
 
 	void Compiler::push_return()
 	{
+		push_byte((uint8_t)OpCode::Null);
 		push_byte((uint8_t)OpCode::Return);
 	}
 
 	void Compiler::patch_jump(int32_t offset)
 	{
-		int32_t jump = (int32_t)current_byte_block().bytes.size() - offset - 2;
+		ByteBlock& block = current_byte_block();
+
+		if (m_WideJumps) {
+			int32_t jump = (int32_t)block.bytes.size() - offset - 3;
+			if (jump > UINT24_MAX) {
+				error("Too much code to jump over");
+			}
+
+			block.bytes[offset] = (jump >> 16) & 0xff;
+			block.bytes[offset + 1] = (jump >> 8) & 0xff;
+			block.bytes[offset + 2] = jump & 0xff;
+		}
+		else {
+			int32_t jump = (int32_t)block.bytes.size() - offset - 2;
+			if (jump > UINT16_MAX) {
+				m_JumpOverflow = true;
+			}
+
+			block.bytes[offset] = (jump >> 8) & 0xff;
+			block.bytes[offset + 1] = jump & 0xff;
+		}
+
+		m_Scope->last_jump_target = (int32_t)current_byte_block().bytes.size();
+	}
+
+	void Compiler::patch_jumps(const std::pmr::vector<int32_t>& offsets)
+	{
+		for (int32_t offset : offsets) {
+			patch_jump(offset);
+		}
+	}
+
+	int32_t Compiler::push_jump_if_false(int32_t operand_start)
+	{
+		ByteBlock& block = current_byte_block();
+		const int32_t size = (int32_t)block.bytes.size();
+
+		// decode the operand to find its last few instructions
+		int32_t tail[4] = { -1, -1, -1, -1 };
+		for (int32_t offset = operand_start; offset < size;) {
+			tail[0] = tail[1];
+			tail[1] = tail[2];
+			tail[2] = tail[3];
+			tail[3] = offset;
+			offset += instruction_length((OpCode)block.bytes[offset]);
+		}
+
+		auto is_at = [&](int32_t offset, OpCode instruction) {
+			return offset >= 0 && (OpCode)block.bytes[offset] == instruction;
+		};
+
+		auto is_less = [&](int32_t offset) {
+			return is_at(offset, OpCode::Less) || is_at(offset, OpCode::LessUnchecked);
+		};
+		auto is_greater = [&](int32_t offset) {
+			return is_at(offset, OpCode::Greater) || is_at(offset, OpCode::GreaterUnchecked);
+		};
+
+		// fuse `local <op> number` with the branch when nothing jumps into the comparison
+		OpCode fused = OpCode::JumpIfFalsePop;
+		int32_t fused_start = -1;
+		if (is_less(tail[3]) || is_greater(tail[3])) {
+			fused = is_less(tail[3]) ? OpCode::JumpIfNotLess : OpCode::JumpIfNotGreater;
+			fused_start = tail[1];
+		}
+		else if (is_at(tail[3], OpCode::Not) && (is_less(tail[2]) || is_greater(tail[2]))) {
+			// >= and <= are compiled as a negated < and >
+			fused = is_less(tail[2]) ? OpCode::JumpIfLess : OpCode::JumpIfGreater;
+			fused_start = tail[0];
+		}
+
+		if (m_WideJumps
+			|| fused_start < m_Scope->last_jump_target
+			|| !is_at(fused_start, OpCode::GetLocal)
+			|| !is_at(fused_start + 2, OpCode::PushConstant)
+			|| !block.constants[block.bytes[fused_start + 3]].is_numeric()) {
+			return push_jump((uint8_t)OpCode::JumpIfFalsePop);
+		}
+
+		uint8_t slot = block.bytes[fused_start + 1];
+		uint8_t constant = block.bytes[fused_start + 3];
+		discard_code(fused_start, block.constants.size());
+
+		push_bytes((uint8_t)fused, slot);
+		push_byte(constant);
+		push_byte(0xff);
+		push_byte(0xff);
+		return (int32_t)current_byte_block().bytes.size() - 2;
+	}
+
+	bool Compiler::in_condition() const
+	{
+		return m_Condition && m_Condition->depth == m_ExpressionDepth;
+	}
+
+	void Compiler::push_literal(Value value)
+	{
+		Literal literal;
+		literal.value = value;
+		literal.start = (int32_t)current_byte_block().bytes.size();
+		literal.constant_count = current_byte_block().constants.size();
+
+		if (value.is(ValueType::Bool)) {
+			push_byte((uint8_t)(value.as_bool() ? OpCode::True : OpCode::False));
+		}
+		else if (value.is(ValueType::Null)) {
+			push_byte((uint8_t)OpCode::Null);
+		}
+		else {
+			push_constant(value);
+		}
+
+		literal.end = (int32_t)current_byte_block().bytes.size();
+		m_Scope->last_literal = literal;
+
+		m_ExpressionType = value.is_numeric() ? StaticType::Number : StaticType::Unknown;
+	}
+
+	const Literal* Compiler::trailing_literal() const
+	{
+		const ByteBlock& block = m_Scope->function->block;
+		if (m_Scope->last_literal.end != (int32_t)block.bytes.size() || m_Scope->last_literal.start < m_Scope->last_jump_target) {
+			return nullptr;
+		}
+
+		return &m_Scope->last_literal;
+	}
+
+	const Literal* Compiler::literal_at(int32_t start) const
+	{
+		const Literal* literal = trailing_literal();
+		if (!literal || literal->start != start) {
+			return nullptr;
+		}
+
+		return literal;
+	}
+
+	void Compiler::discard_code(int32_t offset, size_t constant_count)
+	{
+		ByteBlock& block = current_byte_block();
+		block.bytes.resize(offset);
+		block.lines.resize(offset);
+
+		if (block.constants.size() > constant_count) {
+			block.constants.resize(constant_count);
+		}
+
+		m_Scope->last_jump_target = std::min(m_Scope->last_jump_target, offset);
+		m_Scope->last_literal.end = -1;
+	}
+
+	LocalTypes Compiler::local_types()
+	{
+		LocalTypes types(&m_Arena);
+		types.reserve(m_Scope->locals.size());
+		for (size_t i = 0; i < m_Scope->locals.size(); i++) {
+			types.push_back(m_Scope->locals[i].type);
+		}
+
+		return types;
+	}
+
+	void Compiler::set_local_types(const LocalTypes& types)
+	{
+		for (size_t i = 0; i < types.size() && i < m_Scope->locals.size(); i++) {
+			m_Scope->locals[i].type = types[i];
+		}
+	}
+
+	// where two paths meet, a local keeps its type only if it has it on both
+	void Compiler::join_local_types(const LocalTypes& types)
+	{
+		for (size_t i = 0; i < types.size() && i < m_Scope->locals.size(); i++) {
+			if (m_Scope->locals[i].type != types[i]) {
+				m_Scope->locals[i].type = StaticType::Unknown;
+			}
+		}
+	}
+
+	bool Compiler::fold_binary(TokenType operator_type, Value a, Value b, Value* result) const
+	{
+		switch (operator_type) {
+			case TokenType::EqEq:   *result = Value(a == b);    return true;
+			case TokenType::BangEq: *result = Value(!(a == b)); return true;
+			default:
+				break;
+		}
 
-		if (jump > UINT16_MAX) {
-			error("Too much code to jump over");
+		// mismatched operands are left for the runtime to report
+		if (!a.is_numeric() || !b.is_numeric()) {
+			return false;
+		}
+
+		ArithmeticOp op;
+		switch (operator_type) {
+			case TokenType::Gt:      *result = Value(less_than(b, a));   return true;
+			case TokenType::Gte:     *result = Value(!less_than(a, b));  return true;
+			case TokenType::Lt:      *result = Value(less_than(a, b));   return true;
+			case TokenType::Lte:     *result = Value(!less_than(b, a));  return true;
+			case TokenType::Plus:    op = ArithmeticOp::Add;             break;
+			case TokenType::Minus:   op = ArithmeticOp::Sub;             break;
+			case TokenType::Star:    op = ArithmeticOp::Mul;             break;
+			case TokenType::Slash:   op = ArithmeticOp::Div;             break;
+			case TokenType::Percent: op = ArithmeticOp::Mod;             break;
+			case TokenType::Amp:     op = ArithmeticOp::BitAnd;          break;
+			case TokenType::Pipe:    op = ArithmeticOp::BitOr;           break;
+			case TokenType::Caret:   op = ArithmeticOp::BitXor;          break;
+			case TokenType::LtLt:    op = ArithmeticOp::ShiftLeft;       break;
+			case TokenType::GtGt:    op = ArithmeticOp::ShiftRight;      break;
+			default:
+				return false;
 		}
 
-		current_byte_block().bytes[offset] = (jump >> 8) & 0xff;
-		current_byte_block().bytes[offset + 1] = jump & 0xff;
+		return arithmetic(op, a, b, result) == nullptr;
 	}
 
 	void Compiler::binary(bool can_assign)
 	{
 		TokenType operator_type = m_Parser.previous.type;
-		ParseRule rule = m_ParseRules.at(operator_type);
+		const ParseRule& rule = get_rule(operator_type);
+
+		std::optional<Literal> lhs;
+		if (const Literal* literal = trailing_literal()) {
+			lhs = *literal;
+		}
+
+		StaticType lhs_type = m_ExpressionType;
 		parse_precedence((Precedence)((uint32_t)rule.precedence + 1));
+		bool numbers = lhs_type == StaticType::Number && m_ExpressionType == StaticType::Number;
+
+		if (lhs) {
+			const Literal* rhs = literal_at(lhs->end);
+			Value result;
+			if (rhs && fold_binary(operator_type, lhs->value, rhs->value, &result)) {
+				discard_code(lhs->start, lhs->constant_count);
+				push_literal(result);
+				return;
+			}
+		}
+
+		// operands known to be numbers need no check
+		auto op = [numbers](OpCode generic, OpCode unchecked) {
+			return (uint8_t)(numbers ? unchecked : generic);
+		};
 
 		switch (operator_type) {
-			case TokenType::BangEq: push_bytes((uint8_t)OpCode::Equal, (uint8_t)OpCode::Not);   break;
-			case TokenType::EqEq:   push_byte((uint8_t)OpCode::Equal);                          break;
-			case TokenType::Gt:     push_byte((uint8_t)OpCode::Greater);                        break;
-			case TokenType::Gte:    push_bytes((uint8_t)OpCode::Less, (uint8_t)OpCode::Not);    break;
-			case TokenType::Lt:     push_byte((uint8_t)OpCode::Less);                           break;
-			case TokenType::Lte:    push_bytes((uint8_t)OpCode::Greater, (uint8_t)OpCode::Not); break;
-			case TokenType::Plus:   push_byte((uint8_t)OpCode::Add);                            break;
-			case TokenType::Minus:  push_byte((uint8_t)OpCode::Sub);                            break;
-			case TokenType::Star:   push_byte((uint8_t)OpCode::Mul);                            break;
-			case TokenType::Slash:  push_byte((uint8_t)OpCode::Div);                            break;
+			case TokenType::BangEq:  push_bytes((uint8_t)OpCode::Equal, (uint8_t)OpCode::Not);                         break;
+			case TokenType::EqEq:    push_byte((uint8_t)OpCode::Equal);                                                break;
+			case TokenType::Gt:      push_byte(op(OpCode::Greater, OpCode::GreaterUnchecked));                         break;
+			case TokenType::Gte:     push_bytes(op(OpCode::Less, OpCode::LessUnchecked), (uint8_t)OpCode::Not);        break;
+			case TokenType::Lt:      push_byte(op(OpCode::Less, OpCode::LessUnchecked));                               break;
+			case TokenType::Lte:     push_bytes(op(OpCode::Greater, OpCode::GreaterUnchecked), (uint8_t)OpCode::Not);  break;
+			case TokenType::Plus:    push_byte(op(OpCode::Add, OpCode::AddUnchecked));                                 break;
+			case TokenType::Minus:   push_byte(op(OpCode::Sub, OpCode::SubUnchecked));                                 break;
+			case TokenType::Star:    push_byte(op(OpCode::Mul, OpCode::MulUnchecked));                                 break;
+			case TokenType::Slash:   push_byte(op(OpCode::Div, OpCode::DivUnchecked));                                 break;
+			case TokenType::Percent: push_byte((uint8_t)OpCode::Mod);                                                  break;
+			case TokenType::Amp:     push_byte((uint8_t)OpCode::BitAnd);                                               break;
+			case TokenType::Pipe:    push_byte((uint8_t)OpCode::BitOr);                                                break;
+			case TokenType::Caret:   push_byte((uint8_t)OpCode::BitXor);                                               break;
+			case TokenType::LtLt:    push_byte((uint8_t)OpCode::ShiftLeft);                                            break;
+			case TokenType::GtGt:    push_byte((uint8_t)OpCode::ShiftRight);                                           break;
 			default:
 				// unreachable
 				return;
 		}
+
+		// only + is defined for operands other than numbers, the rest fail on them
+		switch (operator_type) {
+			case TokenType::Plus:    m_ExpressionType = numbers ? StaticType::Number : StaticType::Unknown; break;
+			case TokenType::Minus:
+			case TokenType::Star:
+			case TokenType::Slash:
+			case TokenType::Percent:
+			case TokenType::Amp:
+			case TokenType::Pipe:
+			case TokenType::Caret:
+			case TokenType::LtLt:
+			case TokenType::GtGt:    m_ExpressionType = StaticType::Number;                                break;
+			default:                 m_ExpressionType = StaticType::Unknown;                               break;
+		}
 	}
 
 	void Compiler::literal(bool can_assign)
 	{
 		switch (m_Parser.previous.type) {
-			case TokenType::Null:  push_byte((uint8_t)OpCode::Null);  break;
-			case TokenType::True:  push_byte((uint8_t)OpCode::True);  break;
-			case TokenType::False: push_byte((uint8_t)OpCode::False); break;
+			case TokenType::Null:  push_literal(Value(nullptr)); break;
+			case TokenType::True:  push_literal(Value(true));    break;
+			case TokenType::False: push_literal(Value(false));   break;
 			default:
 				// unreachable
 				return;
@@ -520,26 +1100,47 @@ namespace dynamix {
 
 	void Compiler::named_variable(const Token* name, bool can_assign)
 	{
-		uint8_t get_op;
-		uint8_t set_op;
+		OpCode get_op, get_long_op;
+		OpCode set_op, set_long_op;
 
-		int32_t constant = resolve_local(name);
-		if (constant != -1) {
-			get_op = (uint8_t)OpCode::GetLocal;
-			set_op = (uint8_t)OpCode::SetLocal;
+		int32_t arg = resolve_local(m_Scope, name);
+		if (arg != -1) {
+			get_op = OpCode::GetLocal;
+			get_long_op = OpCode::GetLocalLong;
+			set_op = OpCode::SetLocal;
+			set_long_op = OpCode::SetLocalLong;
+		}
+		else if ((arg = resolve_upvalue(m_Scope, name)) != -1) {
+			// a function has at most 256 upvalues, so the short form always fits
+			get_op = get_long_op = OpCode::GetUpvalue;
+			set_op = set_long_op = OpCode::SetUpvalue;
 		}
 		else {
-			constant = (int32_t)identifier_constant(name);
-			get_op = (uint8_t)OpCode::GetGlobal;
-			set_op = (uint8_t)OpCode::SetGlobal;
+			arg = (int32_t)global_slot(name);
+			get_op = OpCode::GetGlobal;
+			get_long_op = OpCode::GetGlobalLong;
+			set_op = OpCode::SetGlobal;
+			set_long_op = OpCode::SetGlobalLong;
 		}
 
+		// a captured local can be changed by any call, so nothing is assumed about it
+		bool is_local = get_op == OpCode::GetLocal;
+
 		if (can_assign && match(TokenType::Eq)) {
 			expression();
-			push_bytes(set_op, (uint8_t)constant);
+			push_indexed(set_op, set_long_op, (uint32_t)arg);
+
+			if (is_local) {
+				Local& local = m_Scope->locals[(size_t)arg];
+				local.type = local.is_captured ? StaticType::Unknown : m_ExpressionType;
+				local.stores++;
+			}
 		}
 		else {
-			push_bytes(get_op, (uint8_t)constant);
+			push_indexed(get_op, get_long_op, (uint32_t)arg);
+
+			const Local* local = is_local ? &m_Scope->locals[(size_t)arg] : nullptr;
+			m_ExpressionType = local && !local->is_captured ? local->type : StaticType::Unknown;
 		}
 	}
 
@@ -550,40 +1151,60 @@ namespace dynamix {
 
 	void Compiler::string(bool can_assign)
 	{
-		std::string string(m_Parser.previous.start + 1, m_Parser.previous.length - 2);
-		string.push_back('\0');
-		
-		ObjString* object = new ObjString();
-		object->obj.resize(string.size());
-		object->obj.assign(string);
-		((Obj*)object)->type = ObjType::String;
-
-		push_constant(Value((Obj*)object));
+		ObjString* object = m_Heap.intern_string(std::string_view(m_Parser.previous.start + 1, m_Parser.previous.length - 2));
+		push_literal(Value((Obj*)object));
 	}
 
 	void Compiler::number(bool can_assign)
 	{
-		std::string number_string(m_Parser.previous.start, m_Parser.previous.length);
-		remove_char_from_string(number_string, '_');
-		remove_char_from_string(number_string, '\'');
-		number_string.push_back('\0');
+		// digits may be grouped with _ and ', which neither parser accepts
+		char* digits = m_Arena.allocate_chars(m_Parser.previous.length + 1);
+		char* end = std::remove_copy_if(m_Parser.previous.start, m_Parser.previous.start + m_Parser.previous.length, digits,
+			[](char c) { return c == '_' || c == '\''; });
+		*end = '\0'; // for strtod
+
+		// literals without a fraction are integers, unless they are too large for one
+		int64_t integer;
+		auto [parsed, error] = std::from_chars(digits, (const char*)end, integer);
+		if (error == std::errc() && parsed == end && integer >= Value::INTEGER_MIN && integer <= Value::INTEGER_MAX) {
+			push_literal(Value(integer));
+			return;
+		}
 
-		double number = std::strtod(number_string.c_str(), nullptr);
-		push_constant(Value(number));
+		double number = std::strtod(digits, nullptr);
+		push_literal(Value(number));
 	}
 
 	void Compiler::character(bool can_assign)
 	{
 		char character = m_Parser.previous.start[0];
-		push_constant(Value(character));
+		push_literal(Value(character));
 	}
 
 	void Compiler::unary(bool can_assign)
 	{
 		TokenType operator_type = m_Parser.previous.type;
 
+		int32_t operand_start = (int32_t)current_byte_block().bytes.size();
 		parse_precedence(Precedence::Unary);
 
+		if (const Literal* operand = literal_at(operand_start)) {
+			Value value = operand->value;
+			if (operator_type == TokenType::Minus && value.is_numeric()) {
+				// the negation of the smallest integer does not fit one
+				bool integer = value.is(ValueType::Integer) && value.as_integer() != Value::INTEGER_MIN;
+				discard_code(operand_start, operand->constant_count);
+				push_literal(integer ? Value(-value.as_integer()) : Value(-value.to_double()));
+				return;
+			}
+
+			if (operator_type == TokenType::Bang) {
+				discard_code(operand_start, operand->constant_count);
+				push_literal(Value(value.is_falsey()));
+				return;
+			}
+		}
+
 		switch (operator_type) {
 			case TokenType::Minus: push_byte((uint8_t)OpCode::Negate); break;
 			case TokenType::Bang:  push_byte((uint8_t)OpCode::Not);    break;
@@ -591,78 +1212,156 @@ namespace dynamix {
 				// unreachable
 				return;
 		}
+
+		m_ExpressionType = operator_type == TokenType::Minus ? StaticType::Number : StaticType::Unknown;
+	}
+
+	void Compiler::call(bool can_assign)
+	{
+		uint8_t argc = argument_list();
+
+		m_Scope->last_call = (int32_t)current_byte_block().bytes.size();
+		push_bytes((uint8_t)OpCode::Call, argc);
+		m_ExpressionType = StaticType::Unknown;
+	}
+
+	uint8_t Compiler::argument_list()
+	{
+		uint32_t argc = 0;
+		if (!check(TokenType::RParen)) {
+			do {
+				expression();
+				if (argc == UINT8_MAX) {
+					error("cannot have more than 255 arguments");
+				}
+				argc++;
+			} while (match(TokenType::Comma));
+		}
+
+		consume(TokenType::RParen, "expected ')' after arguments");
+		return (uint8_t)argc;
 	}
 
 	void Compiler::and_(bool can_assign)
 	{
+		if (in_condition()) {
+			m_Condition->false_jumps.push_back(push_jump_if_false(m_Condition->operand_start));
+			m_Condition->operand_start = (int32_t)current_byte_block().bytes.size();
+			right_operand(Precedence::And);
+			return;
+		}
+
 		int32_t end_jump = push_jump((uint8_t)OpCode::Jz);
 		push_byte((uint8_t)OpCode::Pop);
 
-		parse_precedence(Precedence::And);
+		right_operand(Precedence::And);
 
 		patch_jump(end_jump);
 	}
 
 	void Compiler::or_(bool can_assign)
 	{
+		if (in_condition()) {
+			// a false left hand side falls through to the right hand side instead of out of the condition
+			m_Condition->true_jumps.push_back(push_jump((uint8_t)OpCode::JumpIfTruePop));
+			patch_jumps(m_Condition->false_jumps);
+			m_Condition->false_jumps.clear();
+
+			m_Condition->operand_start = (int32_t)current_byte_block().bytes.size();
+			right_operand(Precedence::Or);
+			return;
+		}
+
 		int32_t else_jump = push_jump((uint8_t)OpCode::Jz);
 		int32_t end_jump = push_jump((uint8_t)OpCode::Jmp);
 
 		patch_jump(else_jump);
 		push_byte((uint8_t)OpCode::Pop);
 
-		parse_precedence(Precedence::Or);
+		right_operand(Precedence::Or);
 		patch_jump(end_jump);
 	}
 
+	void Compiler::right_operand(Precedence precedence)
+	{
+		// the right hand side of && and || may not run
+		LocalTypes types = local_types();
+		parse_precedence(precedence);
+		join_local_types(types);
+
+		m_ExpressionType = StaticType::Unknown;
+	}
+
 	void Compiler::begin_scope()
 	{
-		m_ScopeDepth++;
+		m_Scope->scope_depth++;
 	}
 
 	void Compiler::end_scope()
 	{
-		m_ScopeDepth--;
+		m_Scope->scope_depth--;
 
-		while (!m_Locals.is_empty() && m_Locals[m_Locals.size() - 1].depth > m_ScopeDepth) {
-			push_byte((uint8_t)OpCode::Pop);
-			m_Locals.pop();
+		while (!m_Scope->locals.is_empty() && m_Scope->locals[m_Scope->locals.size() - 1].depth > m_Scope->scope_depth) {
+			// captured variables move off the stack into their upvalue before the slot is dropped
+			bool is_captured = m_Scope->locals[m_Scope->locals.size() - 1].is_captured;
+			push_byte((uint8_t)(is_captured ? OpCode::CloseUpvalue : OpCode::Pop));
+			m_Scope->locals.pop();
 		}
 	}
 
 	void Compiler::parse_precedence(Precedence precedence)
 	{
 		advance();
-		ParseFn prefix_rule = m_ParseRules.at(m_Parser.previous.type).prefix;
+		ParseFn prefix_rule = get_rule(m_Parser.previous.type).prefix;
 		if (!prefix_rule) {
 			error("expected expression");
 			return;
 		}
 
+		m_ExpressionDepth++;
+
 		bool can_assign = precedence <= Precedence::Assign;
-		prefix_rule(can_assign);
+		(this->*prefix_rule)(can_assign);
 
-		while (precedence <= m_ParseRules.at(m_Parser.current.type).precedence) {
+		while (precedence <= get_rule(m_Parser.current.type).precedence) {
 			advance();
-			ParseFn infix_rule = m_ParseRules.at(m_Parser.previous.type).infix;
-			infix_rule(can_assign);
+			ParseFn infix_rule = get_rule(m_Parser.previous.type).infix;
+			(this->*infix_rule)(can_assign);
 		}
 
 		if (can_assign && match(TokenType::Eq)) {
 			error("invalid assignment target");
 		}
+
+		m_ExpressionDepth--;
 	}
 
-	uint8_t Compiler::identifier_constant(const Token* name)
+	const ParseRule& Compiler::get_rule(TokenType type)
 	{
-		ObjString* object = new ObjString();
-		((Obj*)object)->type = ObjType::String;
+		static_assert(std::size(s_ParseRules) == (size_t)TokenType::Eof + 1, "every token type needs a parse rule");
+		static_assert([] {
+			for (size_t i = 0; i < std::size(s_ParseRules); i++) {
+				if (s_ParseRules[i].token != (TokenType)i) {
+					return false;
+				}
+			}
+			return true;
+		}(), "parse rules have to be listed in the order of TokenType");
+
+		return s_ParseRules[(size_t)type];
+	}
 
-		std::string identifier(name->start, name->length);
+	uint32_t Compiler::global_slot(const Token* name)
+	{
+		ObjString* object = m_Heap.intern_string(std::string_view(name->start, name->length));
 
-		object->obj = identifier;
+		uint32_t slot = m_Globals.resolve(object);
+		if (slot > UINT24_MAX) {
+			error("too many global variables");
+			return 0;
+		}
 
-		return make_constant(Value((Obj*)object));
+		return slot;
 	}
 
 	bool Compiler::identifiers_equal(const Token* name, const Token* other) const
@@ -674,15 +1373,13 @@ namespace dynamix {
 		return memcmp(name->start, other->start, name->length) == 0;
 	}
 
-	int32_t Compiler::resolve_local(const Token* name)
+	int32_t Compiler::resolve_local(FunctionScope* scope, const Token* name)
 	{
-		for (int32_t i = m_Locals.size() - 1; i >= 0; i--) {
-			const Local* local = &m_Locals[(size_t)i];
+		for (int32_t i = scope->locals.size() - 1; i >= 0; i--) {
+			const Local* local = &scope->locals[(size_t)i];
 			if (identifiers_equal(name, &local->name)) {
 				if (local->depth == -1) {
-					std::string var_name(local->name.start, local->name.length);
-					var_name.push_back('\0');
-
+					std::string_view var_name(local->name.start, local->name.length);
 					error(std::format("uninitialized local variable '{}' used", var_name));
 				}
 
@@ -693,9 +1390,50 @@ namespace dynamix {
 		return -1;
 	}
 
+	int32_t Compiler::resolve_upvalue(FunctionScope* scope, const Token* name)
+	{
+		if (!scope->enclosing) {
+			return -1;
+		}
+
+		int32_t local = resolve_local(scope->enclosing, name);
+		if (local != -1) {
+			scope->enclosing->locals[(size_t)local].is_captured = true;
+			scope->enclosing->locals[(size_t)local].type = StaticType::Unknown;
+			scope->enclosing->locals[(size_t)local].stores++;
+			return add_upvalue(scope, (uint32_t)local, true);
+		}
+
+		// captures are flat: a variable from further out is first captured by every function in between
+		int32_t upvalue = resolve_upvalue(scope->enclosing, name);
+		if (upvalue != -1) {
+			return add_upvalue(scope, (uint32_t)upvalue, false);
+		}
+
+		return -1;
+	}
+
+	int32_t Compiler::add_upvalue(FunctionScope* scope, uint32_t index, bool is_local)
+	{
+		std::vector<UpvalueCapture>& captures = scope->function->captures;
+		for (size_t i = 0; i < captures.size(); i++) {
+			if (captures[i].index == index && captures[i].is_local == is_local) {
+				return (int32_t)i;
+			}
+		}
+
+		if (captures.size() > UINT8_MAX) {
+			error("too many closure variables in function");
+			return 0;
+		}
+
+		captures.push_back(UpvalueCapture{ is_local, index });
+		return (int32_t)captures.size() - 1;
+	}
+
 	void Compiler::add_local(const Token* name)
 	{
-		if (m_Locals.size() == LOCAL_CAPACITY) {
+		if (m_Scope->locals.size() == LOCAL_CAPACITY) {
 			error("too many local variables in function");
 			return;
 		}
@@ -703,26 +1441,24 @@ namespace dynamix {
 		Local local;
 		local.name = *name;
 		local.depth = -1;
-		m_Locals.push(local);
+		m_Scope->locals.push(local);
 	}
 
 	void Compiler::declare_variable()
 	{
-		if (m_ScopeDepth == 0) {
+		if (m_Scope->scope_depth == 0) {
 			return;
 		}
 
 		Token* name = &m_Parser.previous;
-		for (int32_t i = m_Locals.size() - 1; i >= 0; i--) {
-			Local* local = &m_Locals[(size_t)i];
-			if (local->depth != -1 && local->depth < (int32_t)m_ScopeDepth) {
+		for (int32_t i = m_Scope->locals.size() - 1; i >= 0; i--) {
+			Local* local = &m_Scope->locals[(size_t)i];
+			if (local->depth != -1 && local->depth < (int32_t)m_Scope->scope_depth) {
 				break;
 			}
 
 			if (identifiers_equal(name, &local->name)) {
-				std::string var_name(name->start, name->length);
-				var_name.push_back('\0');
-
+				std::string_view var_name(name->start, name->length);
 				error(std::format("variable '{}' has multiple definitions; multiple initialization", var_name));
 			}
 		}
@@ -730,70 +1466,59 @@ namespace dynamix {
 		add_local(name);
 	}
 
-	uint8_t Compiler::parse_variable(const std::string& error)
+	uint32_t Compiler::parse_variable(std::string_view error)
 	{
 		consume(TokenType::Ident, error);
 
 		declare_variable();
-		if (m_ScopeDepth > 0) {
+		if (m_Scope->scope_depth > 0) {
 			return 0;
 		}
 
-		return identifier_constant(&m_Parser.previous);
+		return global_slot(&m_Parser.previous);
 	}
 
 	void Compiler::mark_initialized()
 	{
-		if (m_ScopeDepth == 0) {
+		if (m_Scope->scope_depth == 0) {
 			return;
 		}
 
-		m_Locals[m_Locals.size() - 1].depth = m_ScopeDepth;
+		m_Scope->locals[m_Scope->locals.size() - 1].depth = m_Scope->scope_depth;
 	}
 
-	void Compiler::define_variable(uint8_t global)
+	void Compiler::define_variable(uint32_t global)
 	{
-		if (m_ScopeDepth > 0) {
+		if (m_Scope->scope_depth > 0) {
 			mark_initialized();
 			return;
 		}
 
-		push_bytes((uint8_t)OpCode::DefineGlobal, global);
+		push_indexed(OpCode::DefineGlobal, OpCode::DefineGlobalLong, global);
 	}
 
-	uint8_t Compiler::make_constant(Value value)
+	uint32_t Compiler::make_constant(Value value)
 	{
 		int32_t constant = current_byte_block().add_constant(value);
-		if (constant > UINT8_MAX) {
+		if (constant > UINT24_MAX) {
 			error("too many constants in one block");
 			return 0;
 		}
 
-		return (uint8_t)constant;
-	}
-
-	void Compiler::remove_char_from_string(std::string& str, char c) const
-	{
-		while (size_t pos = str.find(c)) {
-			if (pos == std::string::npos) {
-				return;
-			}
-
-			str.replace(pos, 1, "");
-		}
+		return (uint32_t)constant;
 	}
 
 	ByteBlock& Compiler::current_byte_block()
 	{
-		return m_Function->block;
+		return m_Scope->function->block;
 	}
 
-	void Compiler::error(const std::string& msg)
+	void Compiler::error(std::string_view msg)
 	{
 		error_at(&m_Parser.previous, msg);
 	}
 
-	void Compiler::error_at(const Token* token, const std::string& msg)
+	void Compiler::error_at(const Token* token, std::string_view msg)
 	{
 		if (m_Parser.panic_mode) {
 			return;
@@ -810,14 +1535,7 @@ namespace dynamix {
 			// Nothing
 		}
 		else {
-			const char* format = " at '%.*s'";
-			size_t buf_size = token->length + strlen(format);
-			char* buf = (char*)malloc(buf_size);
-			if (buf) {
-				sprintf_s(buf, buf_size, format, token->length, token->start);
-				error.append(buf);
-			}
-			free(buf);
+			error += std::format(" at '{}'", std::string_view(token->start, token->length));
 		}
 
 		error += std::format(": {}\n", msg);
@@ -825,7 +1543,7 @@ namespace dynamix {
 		m_Parser.had_error = true;
 	}
 
-	void Compiler::error_at_current(const std::string& msg)
+	void Compiler::error_at_current(std::string_view msg)
 	{
 		error_at(&m_Parser.current, msg);
 	}
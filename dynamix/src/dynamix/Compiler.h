@@ -1,13 +1,25 @@
 #pragma once
 
+#include "Arena.h"
 #include "ByteBlock.h"
+#include "Heap.h"
+#include "Globals.h"
 #include "Lexer.h"
 #include "Value.h"
 #include "Stack.h"
 
-#include <unordered_map>
-#include <functional>
 #include <string>
+#include <string_view>
+#include <vector>
+#include <memory_resource>
+#include <unordered_map>
+#include <optional>
+
+// Locals past the first 256 are addressed with the `Long` instruction forms.
+#define LOCAL_CAPACITY (UINT16_MAX + 1)
+// Room a function scope starts with for its locals. It lives in the compiler's
+// arena, which never reuses what a scope grows out of, so this stays small.
+#define LOCAL_RESERVE 16
 
 namespace dynamix {
 
@@ -19,26 +31,73 @@ namespace dynamix {
 		And,         // and
 		Equality,    // == !=
 		Comparison,  // < > <= >=
+		BitOr,       // |
+		BitXor,      // ^
+		BitAnd,      // &
+		Shift,       // << >>
 		Term,        // + -
-		Factor,      // * /
+		Factor,      // * / %
 		Unary,       // ! -
 		Call,        // . ()
 		Atom
 	};
 
-	using ParseFn = std::function<void(bool)>;
+	class Compiler;
+
+	// Parse functions are members of the compiler, so one table of rules serves
+	// every compiler instead of each binding its own.
+	using ParseFn = void (Compiler::*)(bool can_assign);
 
 	struct ParseRule
 	{
+		TokenType token;
 		ParseFn prefix;
 		ParseFn infix;
 		Precedence precedence;
 	};
 
+	// The most recently emitted literal push, tracked so that operators applied to
+	// literal operands can be folded and constant branches dropped.
+	struct Literal
+	{
+		Value value;
+		int32_t start = -1;
+		int32_t end = -1;
+		size_t constant_count = 0;
+	};
+
+	// A branch condition being compiled as jumping code. Instead of leaving a bool
+	// on the stack, top level && and || operands branch straight to their outcome.
+	struct Condition
+	{
+		explicit Condition(std::pmr::memory_resource* memory)
+			: false_jumps(memory), true_jumps(memory) {}
+
+		uint32_t depth = 0;
+		int32_t operand_start = 0;
+		std::pmr::vector<int32_t> false_jumps;
+		std::pmr::vector<int32_t> true_jumps;
+		std::optional<bool> constant;
+	};
+
+	// What the compiler can prove about a value before the script runs.
+	enum class StaticType
+	{
+		Unknown,
+		Number,
+	};
+
+	// Types of the locals of the function being compiled, saved to be restored or
+	// joined where control flow meets. They are kept in the compiler's arena.
+	using LocalTypes = std::pmr::vector<StaticType>;
+
 	struct Local
 	{
 		Token name;
 		int32_t depth;
+		bool is_captured = false;
+		StaticType type = StaticType::Unknown; // at the point being compiled
+		uint32_t stores = 0;                    // assignments compiled so far, to tell which ones a loop makes
 	};
 
 	enum class FunctionType
@@ -47,6 +106,41 @@ namespace dynamix {
 		Script,
 	};
 
+	// Compilation state of one function. A nested function declaration gets its own
+	// scope, linked to the function it is declared in through `enclosing`.
+	struct FunctionScope
+	{
+		explicit FunctionScope(std::pmr::memory_resource* memory)
+			: locals(memory) {}
+
+		FunctionScope* enclosing = nullptr;
+		ObjFunction* function = nullptr;
+		FunctionType type = FunctionType::Script;
+
+		Stack<Local, std::pmr::polymorphic_allocator<Local>> locals;
+		uint32_t scope_depth = 0;
+
+		Literal last_literal;
+		int32_t last_jump_target = 0;
+		int32_t last_call = -1;
+	};
+
+	// Which interpreter loop runs the compiled code. The register backend lifts each
+	// function's stack bytecode into an IR over its slot window, optimizes it and
+	// lowers it to three-address register code.
+	enum class Backend
+	{
+		Stack,
+		Register,
+	};
+
+	struct CompilerOptions
+	{
+		bool peephole = true;
+		Backend backend = Backend::Stack;
+		uint32_t optimization_level = 1; // IR passes run by the register backend, see PassManager::for_level
+	};
+
 	struct Parser
 	{
 		Token previous;
@@ -58,13 +152,19 @@ namespace dynamix {
 	class Compiler
 	{
 	public:
-		Compiler(const std::string& filepath, const std::string& source);
+		Compiler(const std::string& filepath, const std::string& source, Heap& heap, Globals& globals, const CompilerOptions& options);
 
 		ObjFunction* compile();
 
 		const std::string& get_last_error() const;
 
 	private:
+		void reset();
+		void release_arena();
+		void compile_script();
+		void begin_function(FunctionScope* scope, FunctionType type);
+		ObjFunction* end_function();
+
 		Token advance();
 		
 		void expression();
@@ -73,16 +173,22 @@ namespace dynamix {
 		void statement();
 		void expression_statement();
 		void print_statement();
+		void return_statement();
 		void if_statement();
 		void while_statement();
 		void for_statement();
+		void branch_body(bool reachable);
+		template <typename CompileLoop>
+		void typed_loop(const CompileLoop& compile_loop);
+		Condition condition();
+		bool is_grouped_condition();
 		void declaration();
 		void let_declaration();
 		void fun_declaration();
 
 		void synchronize();
 		
-		void consume(TokenType expected, const std::string& msg);
+		void consume(TokenType expected, std::string_view msg);
 		bool match(TokenType type);
 		bool check(TokenType type);
 
@@ -90,10 +196,24 @@ namespace dynamix {
 		void push_bytes(uint8_t one, uint8_t two);
 		void push_loop(int32_t loop_start);
 		int32_t push_jump(uint8_t instruction);
+		void push_indexed(OpCode instruction, OpCode long_instruction, uint32_t index);
 		void push_constant(Value value);
 		void push_return();
 
 		void patch_jump(int32_t offset);
+		void patch_jumps(const std::pmr::vector<int32_t>& offsets);
+		int32_t push_jump_if_false(int32_t operand_start);
+		bool in_condition() const;
+
+		void push_literal(Value value);
+		const Literal* trailing_literal() const;
+		const Literal* literal_at(int32_t start) const;
+		void discard_code(int32_t offset, size_t constant_count);
+		bool fold_binary(TokenType operator_type, Value a, Value b, Value* result) const;
+
+		LocalTypes local_types();
+		void set_local_types(const LocalTypes& types);
+		void join_local_types(const LocalTypes& types);
 		
 		void binary(bool can_assign);
 		void literal(bool can_assign);
@@ -104,43 +224,70 @@ namespace dynamix {
 		void number(bool can_assign);
 		void character(bool can_assign);
 		void unary(bool can_assign);
+		void call(bool can_assign);
+		uint8_t argument_list();
 		void and_(bool can_assign);
 		void or_(bool can_assign);
+		void right_operand(Precedence precedence);
 		
 		void begin_scope();
 		void end_scope();
 
 		void parse_precedence(Precedence precedence);
-		uint8_t identifier_constant(const Token* name);
+		static const ParseRule& get_rule(TokenType type);
+		uint32_t global_slot(const Token* name);
 		bool identifiers_equal(const Token* name, const Token* other) const;
-		int32_t resolve_local(const Token* name);
+		int32_t resolve_local(FunctionScope* scope, const Token* name);
+		int32_t resolve_upvalue(FunctionScope* scope, const Token* name);
+		int32_t add_upvalue(FunctionScope* scope, uint32_t index, bool is_local);
 		void add_local(const Token* name);
 		void declare_variable();
-		uint8_t parse_variable(const std::string& error);
+		uint32_t parse_variable(std::string_view error);
 		void mark_initialized();
-		void define_variable(uint8_t global);
+		void define_variable(uint32_t global);
 
-		uint8_t make_constant(Value value);
-		void remove_char_from_string(std::string& str, char c) const;
+		uint32_t make_constant(Value value);
 
 		ByteBlock& current_byte_block();
-		void error(const std::string& msg);
-		void error_at(const Token* token, const std::string& msg);
-		void error_at_current(const std::string& msg);
+		void error(std::string_view msg);
+		void error_at(const Token* token, std::string_view msg);
+		void error_at_current(std::string_view msg);
 
 	private:
-		ObjFunction* m_Function = nullptr;
-		FunctionType m_Type;
+		static const ParseRule s_ParseRules[];
+
 		std::string m_Filename;
 		std::string m_LastError;
+		CompilerOptions m_Options;
+
+		Heap& m_Heap;
+		Globals& m_Globals;
 		
+		// transient data of the compilation, dropped when `compile` is done. Only the
+		// functions and their constants go on the VM heap.
+		Arena m_Arena;
+
 		Lexer m_Lexer;
 		Parser m_Parser;
 
-		std::unordered_map<TokenType, ParseRule> m_ParseRules;
+		std::optional<FunctionScope> m_ScriptScope;
+		FunctionScope* m_Scope = nullptr;
+		std::pmr::vector<ObjFunction*> m_Functions;
+
+		// entry types each loop was last solved for, by where its source starts, so a
+		// nested loop is not solved from scratch again on every pass of the ones around it
+		std::pmr::unordered_map<const char*, LocalTypes> m_LoopTypes;
+
+		// forward jumps are emitted before their distance is known, so when one
+		// does not fit in 16 bits the script is compiled again with 24-bit jumps
+		bool m_WideJumps = false;
+		bool m_JumpOverflow = false;
+
+		Condition* m_Condition = nullptr;
+		uint32_t m_ExpressionDepth = 0;
 
-		Stack<Local> m_Locals;
-		uint32_t m_ScopeDepth;
+		// type of the value the last compiled expression leaves on the stack
+		StaticType m_ExpressionType = StaticType::Unknown;
 	};
 
 }
@@ -0,0 +1,152 @@
+#include "DecodedBlock.h"
+
+#include "Peephole.h"
+
+#include <algorithm>
+
+namespace dynamix {
+
+	// how many values an instruction leaves on the stack, minus the ones it takes
+	static int32_t stack_effect(OpCode op, uint32_t operand)
+	{
+		switch (op) {
+			case OpCode::PushConstant:
+			case OpCode::PushConstantLong:
+			case OpCode::PushZero:
+			case OpCode::PushOne:
+			case OpCode::Null:
+			case OpCode::True:
+			case OpCode::False:
+			case OpCode::GetGlobal:
+			case OpCode::GetGlobalLong:
+			case OpCode::GetLocal:
+			case OpCode::GetLocalLong:
+			case OpCode::GetLocal0:
+			case OpCode::GetLocal1:
+			case OpCode::GetLocal2:
+			case OpCode::GetLocal3:
+			case OpCode::GetUpvalue:
+			case OpCode::Closure:
+			case OpCode::ClosureLong:
+				return 1;
+			case OpCode::Pop:
+			case OpCode::Equal:
+			case OpCode::Greater:
+			case OpCode::Less:
+			case OpCode::NotEqual:
+			case OpCode::GreaterEqual:
+			case OpCode::LessEqual:
+			case OpCode::Add:
+			case OpCode::Sub:
+			case OpCode::Div:
+			case OpCode::Mul:
+			case OpCode::Mod:
+			case OpCode::BitAnd:
+			case OpCode::BitOr:
+			case OpCode::BitXor:
+			case OpCode::ShiftLeft:
+			case OpCode::ShiftRight:
+			case OpCode::GreaterUnchecked:
+			case OpCode::LessUnchecked:
+			case OpCode::GreaterEqualUnchecked:
+			case OpCode::LessEqualUnchecked:
+			case OpCode::AddUnchecked:
+			case OpCode::SubUnchecked:
+			case OpCode::DivUnchecked:
+			case OpCode::MulUnchecked:
+			case OpCode::GreaterNumNum:
+			case OpCode::LessNumNum:
+			case OpCode::GreaterEqualNumNum:
+			case OpCode::LessEqualNumNum:
+			case OpCode::AddNumNum:
+			case OpCode::SubNumNum:
+			case OpCode::DivNumNum:
+			case OpCode::MulNumNum:
+			case OpCode::JumpIfFalsePop:
+			case OpCode::JumpIfFalsePopLong:
+			case OpCode::JumpIfTruePop:
+			case OpCode::JumpIfTruePopLong:
+			case OpCode::DefineGlobal:
+			case OpCode::DefineGlobalLong:
+			case OpCode::StoreLocalPop:
+			case OpCode::CloseUpvalue:
+			case OpCode::Print:
+			case OpCode::Return:
+				return -1;
+			case OpCode::Call:
+			case OpCode::TailCall:
+				// the callee and its arguments make way for the result
+				return -(int32_t)operand;
+			default:
+				return 0;
+		}
+	}
+
+	DecodedBlock DecodedBlock::decode(const ByteBlock* block, uint32_t arity)
+	{
+		const int32_t size = (int32_t)block->bytes.size();
+
+		DecodedBlock decoded;
+		std::vector<uint32_t> index_at(size + 1, 0);
+		for (int32_t offset = 0; offset < size; offset += instruction_length((OpCode)block->bytes[offset])) {
+			index_at[offset] = (uint32_t)decoded.offsets.size();
+			decoded.offsets.push_back(offset);
+		}
+		index_at[size] = (uint32_t)decoded.offsets.size();
+		decoded.code.reserve(decoded.offsets.size());
+
+		// code after a jump that does not come back is entered with the depth of a
+		// jump to it
+		std::vector<int32_t> target_depth(decoded.offsets.size() + 1, -1);
+		int32_t depth = arity + 1;
+		decoded.max_depth = depth;
+		bool reachable = true;
+
+		for (int32_t offset : decoded.offsets) {
+			OpCode op = (OpCode)block->bytes[offset];
+			int32_t length = instruction_length(op);
+			const uint8_t* operands = block->bytes.data() + offset + 1;
+			uint32_t operand = length == 4 ? (operands[0] << 16) | (operands[1] << 8) | operands[2] : length > 1 ? operands[0] : 0;
+
+			uint32_t index = (uint32_t)decoded.code.size();
+			if (!reachable && target_depth[index] >= 0) {
+				depth = target_depth[index];
+			}
+
+			depth += stack_effect(op, operand);
+			decoded.max_depth = std::max<uint32_t>(decoded.max_depth, depth);
+			reachable = op != OpCode::Jmp && op != OpCode::JmpLong && op != OpCode::Loop && op != OpCode::LoopLong
+				&& op != OpCode::TailCall && op != OpCode::Return;
+
+			DecodedInstruction instruction{ op };
+			switch (op) {
+				case OpCode::PushConstant:
+				case OpCode::PushConstantLong:
+				case OpCode::Closure:
+				case OpCode::ClosureLong:
+					instruction.constant = &block->constants[operand];
+					break;
+				case OpCode::JumpIfNotLess:
+				case OpCode::JumpIfNotGreater:
+				case OpCode::JumpIfLess:
+				case OpCode::JumpIfGreater:
+					instruction.a = operands[0];
+					instruction.constant = &block->constants[operands[1]];
+					instruction.b = index_at[Peephole::jump_target(block, offset)];
+					target_depth[instruction.b] = depth;
+					break;
+				default:
+					instruction.a = Peephole::is_jump(op) ? index_at[Peephole::jump_target(block, offset)] : operand;
+					if (Peephole::is_jump(op)) {
+						target_depth[instruction.a] = depth;
+					}
+					break;
+			}
+
+			decoded.code.push_back(instruction);
+		}
+
+		return decoded;
+	}
+
+}
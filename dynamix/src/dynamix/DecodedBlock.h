@@ -0,0 +1,37 @@
+#pragma once
+
+#include "ByteBlock.h"
+
+#include <vector>
+#include <cstdint>
+
+namespace dynamix {
+
+	// An instruction of the stack machine with its operands decoded ahead of time.
+	// `a` holds the slot, index or argument count the bytecode encodes, jumps hold
+	// the index of their target instruction in `a`, or in `b` for the compare and
+	// branch forms, and constant operands point straight into the constant table.
+	struct DecodedInstruction
+	{
+		OpCode op;
+		uint32_t a = 0;
+		uint32_t b = 0;
+		const Value* constant = nullptr;
+	};
+
+	// The code the stack machine runs for a ByteBlock. The bytes stay around for the
+	// disassembler, `offsets` maps every instruction back to its first byte and so
+	// to its line. `max_depth` is the most slots the function's frame ever uses,
+	// counted from the callee slot, so a call can check it fits on the stack.
+	struct DecodedBlock
+	{
+	public:
+		std::vector<DecodedInstruction> code;
+		std::vector<int32_t> offsets;
+		uint32_t max_depth = 0;
+
+		// The constant table of `block` must not change afterwards.
+		static DecodedBlock decode(const ByteBlock* block, uint32_t arity);
+	};
+
+}
@@ -1,6 +1,7 @@
 #include "Disassembler.h"
 
 #include "dynamix.h"
+#include "Object.h"
 
 #include <iostream>
 #include <format>
@@ -30,6 +31,7 @@ namespace dynamix {
 		uint8_t instruction = block->bytes[offset];
 		switch ((OpCode)instruction) {
 			case OpCode::PushConstant: return constant_instruction("PUSH CONSTANT", block, offset);
+			case OpCode::PushConstantLong: return constant_long_instruction("PUSH CONSTANT LONG", block, offset);
 			case OpCode::Pop:          return simple_instruction("POP", offset);
 			case OpCode::Null:         return simple_instruction("NULL", offset);
 			case OpCode::True:         return simple_instruction("TRUE", offset);
@@ -37,21 +39,83 @@ namespace dynamix {
 			case OpCode::Equal:        return simple_instruction("EQUAL", offset);
 			case OpCode::Greater:      return simple_instruction("GREATER", offset);
 			case OpCode::Less:         return simple_instruction("LESS", offset);
+			case OpCode::NotEqual:     return simple_instruction("NOT EQUAL", offset);
+			case OpCode::GreaterEqual: return simple_instruction("GREATER EQUAL", offset);
+			case OpCode::LessEqual:    return simple_instruction("LESS EQUAL", offset);
 			case OpCode::Add:          return simple_instruction("ADD", offset);
 			case OpCode::Sub:          return simple_instruction("SUB", offset);
 			case OpCode::Mul:          return simple_instruction("MUL", offset);
 			case OpCode::Div:          return simple_instruction("DIV", offset);
+			case OpCode::Mod:          return simple_instruction("MOD", offset);
+			case OpCode::BitAnd:       return simple_instruction("BIT AND", offset);
+			case OpCode::BitOr:        return simple_instruction("BIT OR", offset);
+			case OpCode::BitXor:       return simple_instruction("BIT XOR", offset);
+			case OpCode::ShiftLeft:    return simple_instruction("SHIFT LEFT", offset);
+			case OpCode::ShiftRight:   return simple_instruction("SHIFT RIGHT", offset);
+			case OpCode::GreaterUnchecked:      return simple_instruction("GREATER UNCHECKED", offset);
+			case OpCode::LessUnchecked:         return simple_instruction("LESS UNCHECKED", offset);
+			case OpCode::GreaterEqualUnchecked: return simple_instruction("GREATER EQUAL UNCHECKED", offset);
+			case OpCode::LessEqualUnchecked:    return simple_instruction("LESS EQUAL UNCHECKED", offset);
+			case OpCode::AddUnchecked:          return simple_instruction("ADD UNCHECKED", offset);
+			case OpCode::SubUnchecked:          return simple_instruction("SUB UNCHECKED", offset);
+			case OpCode::DivUnchecked:          return simple_instruction("DIV UNCHECKED", offset);
+			case OpCode::MulUnchecked:          return simple_instruction("MUL UNCHECKED", offset);
+			case OpCode::GreaterNumNum:      return simple_instruction("GREATER NUM NUM", offset);
+			case OpCode::LessNumNum:         return simple_instruction("LESS NUM NUM", offset);
+			case OpCode::GreaterEqualNumNum: return simple_instruction("GREATER EQUAL NUM NUM", offset);
+			case OpCode::LessEqualNumNum:    return simple_instruction("LESS EQUAL NUM NUM", offset);
+			case OpCode::AddNumNum:          return simple_instruction("ADD NUM NUM", offset);
+			case OpCode::SubNumNum:          return simple_instruction("SUB NUM NUM", offset);
+			case OpCode::DivNumNum:          return simple_instruction("DIV NUM NUM", offset);
+			case OpCode::MulNumNum:          return simple_instruction("MUL NUM NUM", offset);
 			case OpCode::Negate:       return simple_instruction("NEGATE", offset);
 			case OpCode::Not:          return simple_instruction("NOT", offset);
-			case OpCode::Jmp:          return jump_instruction("JZ", 1, block, offset);
-			case OpCode::Jz:           return jump_instruction("JMP", 1, block, offset);
+			case OpCode::Jmp:          return jump_instruction("JMP", 1, block, offset);
+			case OpCode::JmpLong:      return long_jump_instruction("JMP LONG", 1, block, offset);
+			case OpCode::Jz:           return jump_instruction("JZ", 1, block, offset);
+			case OpCode::JzLong:       return long_jump_instruction("JZ LONG", 1, block, offset);
 			case OpCode::Loop:         return jump_instruction("LOOP", -1, block, offset);
-			case OpCode::DefineGlobal: return constant_instruction("DEFINE GLOBAL", block, offset);
-			case OpCode::GetGlobal:    return constant_instruction("GET GLOBAL", block, offset);
-			case OpCode::SetGlobal:    return constant_instruction("SET GLOBAL", block, offset);
+			case OpCode::LoopLong:     return long_jump_instruction("LOOP LONG", -1, block, offset);
+			case OpCode::JumpIfFalsePop:     return jump_instruction("JUMP IF FALSE POP", 1, block, offset);
+			case OpCode::JumpIfFalsePopLong: return long_jump_instruction("JUMP IF FALSE POP LONG", 1, block, offset);
+			case OpCode::JumpIfTruePop:      return jump_instruction("JUMP IF TRUE POP", 1, block, offset);
+			case OpCode::JumpIfTruePopLong:  return long_jump_instruction("JUMP IF TRUE POP LONG", 1, block, offset);
+			case OpCode::JumpIfNotLess:    return compare_jump_instruction("JUMP IF NOT LESS", block, offset);
+			case OpCode::JumpIfNotGreater: return compare_jump_instruction("JUMP IF NOT GREATER", block, offset);
+			case OpCode::JumpIfLess:       return compare_jump_instruction("JUMP IF LESS", block, offset);
+			case OpCode::JumpIfGreater:    return compare_jump_instruction("JUMP IF GREATER", block, offset);
+			case OpCode::DefineGlobal: return byte_instruction("DEFINE GLOBAL", block, offset);
+			case OpCode::DefineGlobalLong: return long_instruction("DEFINE GLOBAL LONG", block, offset);
+			case OpCode::GetGlobal:    return byte_instruction("GET GLOBAL", block, offset);
+			case OpCode::GetGlobalLong: return long_instruction("GET GLOBAL LONG", block, offset);
+			case OpCode::SetGlobal:    return byte_instruction("SET GLOBAL", block, offset);
+			case OpCode::SetGlobalLong: return long_instruction("SET GLOBAL LONG", block, offset);
 			case OpCode::GetLocal:     return byte_instruction("GET LOCAL", block, offset);
+			case OpCode::GetLocalLong: return long_instruction("GET LOCAL LONG", block, offset);
 			case OpCode::SetLocal:     return byte_instruction("SET LOCAL", block, offset);
+			case OpCode::SetLocalLong: return long_instruction("SET LOCAL LONG", block, offset);
+			case OpCode::StoreLocalPop: return byte_instruction("STORE LOCAL POP", block, offset);
+			case OpCode::PushZero:     return simple_instruction("PUSH ZERO", offset);
+			case OpCode::PushOne:      return simple_instruction("PUSH ONE", offset);
+			case OpCode::GetLocal0:    return simple_instruction("GET LOCAL 0", offset);
+			case OpCode::GetLocal1:    return simple_instruction("GET LOCAL 1", offset);
+			case OpCode::GetLocal2:    return simple_instruction("GET LOCAL 2", offset);
+			case OpCode::GetLocal3:    return simple_instruction("GET LOCAL 3", offset);
+			case OpCode::SetLocal0:    return simple_instruction("SET LOCAL 0", offset);
+			case OpCode::SetLocal1:    return simple_instruction("SET LOCAL 1", offset);
+			case OpCode::SetLocal2:    return simple_instruction("SET LOCAL 2", offset);
+			case OpCode::SetLocal3:    return simple_instruction("SET LOCAL 3", offset);
+			case OpCode::IncLocal:     return byte_instruction("INC LOCAL", block, offset);
+			case OpCode::GetUpvalue:   return byte_instruction("GET UPVALUE", block, offset);
+			case OpCode::SetUpvalue:   return byte_instruction("SET UPVALUE", block, offset);
+			case OpCode::CloseUpvalue: return simple_instruction("CLOSE UPVALUE", offset);
+			case OpCode::Closure:
+				return closure_instruction("CLOSURE", block->bytes[offset + 1], 2, block, offset);
+			case OpCode::ClosureLong:
+				return closure_instruction("CLOSURE LONG", (block->bytes[offset + 1] << 16) | (block->bytes[offset + 2] << 8) | block->bytes[offset + 3], 4, block, offset);
 			case OpCode::Print:        return simple_instruction("PRINT", offset);
+			case OpCode::Call:         return byte_instruction("CALL", block, offset);
+			case OpCode::TailCall:     return byte_instruction("TAIL CALL", block, offset);
 			case OpCode::Return:       return simple_instruction("RETURN", offset);
 			default:
 				printf("Unknown opcode %d\n", instruction);
@@ -74,6 +138,15 @@ namespace dynamix {
 		return offset + 2;
 	}
 
+	int32_t Disassembler::constant_long_instruction(const char* name, ByteBlock* block, int32_t offset)
+	{
+		uint32_t constant = (block->bytes[offset + 1] << 16) | (block->bytes[offset + 2] << 8) | block->bytes[offset + 3];
+		printf("OPCODE: %-16s %4d '", name, constant);
+		block->constants[constant].print(false);
+		printf("'\n");
+		return offset + 4;
+	}
+
 	int32_t Disassembler::byte_instruction(const char* name, ByteBlock* block, int32_t offset)
 	{
 		uint8_t slot = block->bytes[offset + 1];
@@ -81,6 +154,13 @@ namespace dynamix {
 		return offset + 2;
 	}
 
+	int32_t Disassembler::long_instruction(const char* name, ByteBlock* block, int32_t offset)
+	{
+		uint32_t slot = (block->bytes[offset + 1] << 16) | (block->bytes[offset + 2] << 8) | block->bytes[offset + 3];
+		printf("OPCODE: %-16s %4d\n", name, slot);
+		return offset + 4;
+	}
+
 	int32_t Disassembler::jump_instruction(const char* name, int32_t sign, ByteBlock* block, int32_t offset)
 	{
 		uint16_t jump = (uint16_t)(block->bytes[offset + 1] << 8);
@@ -89,4 +169,172 @@ namespace dynamix {
 		return offset + 3;
 	}
 
+	int32_t Disassembler::long_jump_instruction(const char* name, int32_t sign, ByteBlock* block, int32_t offset)
+	{
+		int32_t jump = (block->bytes[offset + 1] << 16) | (block->bytes[offset + 2] << 8) | block->bytes[offset + 3];
+		printf("OPCODE: %-16s %4d -> %d\n", name, offset, offset + 4 + sign * jump);
+		return offset + 4;
+	}
+
+	int32_t Disassembler::closure_instruction(const char* name, uint32_t constant, int32_t length, ByteBlock* block, int32_t offset)
+	{
+		printf("OPCODE: %-16s %4d '", name, constant);
+		block->constants[constant].print(false);
+		printf("'\n");
+
+		ObjFunction* function = block->constants[constant].as_function();
+		for (const UpvalueCapture& capture : function->captures) {
+			printf("%04d    |                     %s %d\n", offset, capture.is_local ? "local" : "upvalue", capture.index);
+		}
+
+		return offset + length;
+	}
+
+	int32_t Disassembler::compare_jump_instruction(const char* name, ByteBlock* block, int32_t offset)
+	{
+		uint8_t slot = block->bytes[offset + 1];
+		uint8_t constant = block->bytes[offset + 2];
+		uint16_t jump = (uint16_t)(block->bytes[offset + 3] << 8);
+		jump |= block->bytes[offset + 4];
+		printf("OPCODE: %-16s %4d %4d '", name, slot, constant);
+		block->constants[constant].print(false);
+		printf("' -> %d\n", offset + 5 + jump);
+		return offset + 5;
+	}
+
+	void Disassembler::disassemble_registers(const RegisterBlock* registers, const ByteBlock* block, const char* name)
+	{
+		std::cout << std::format("-- {} ({} registers) --\n", name, registers->register_count);
+
+		for (int32_t index = 0; index < (int32_t)registers->code.size();) {
+			index = disassemble_register_instruction(registers, block, index);
+		}
+	}
+
+	int32_t Disassembler::disassemble_register_instruction(const RegisterBlock* registers, const ByteBlock* block, int32_t index)
+	{
+		printf("%04d ", index);
+
+		if (index > 0 && registers->lines[index] == registers->lines[(size_t)index - 1]) {
+			printf("   | ");
+		}
+		else {
+			printf("%4d ", registers->lines[index]);
+		}
+
+		// operand layouts: a destination register, rk operands, a plain index or a jump target
+		enum class Layout { A, AB, AConstant, ABC, RK, RKIndex, AIndex, Target, RKTarget, RKRKTarget, ACount };
+
+		const RegisterInstruction& instruction = registers->code[index];
+		const char* name = "?";
+		Layout layout = Layout::A;
+		switch (instruction.op) {
+			case RegisterOp::Move:             name = "MOVE";                layout = Layout::AB;         break;
+			case RegisterOp::LoadNull:         name = "LOAD NULL";           layout = Layout::A;          break;
+			case RegisterOp::LoadTrue:         name = "LOAD TRUE";           layout = Layout::A;          break;
+			case RegisterOp::LoadFalse:        name = "LOAD FALSE";          layout = Layout::A;          break;
+			case RegisterOp::Equal:            name = "EQUAL";               layout = Layout::ABC;        break;
+			case RegisterOp::Greater:          name = "GREATER";             layout = Layout::ABC;        break;
+			case RegisterOp::Less:             name = "LESS";                layout = Layout::ABC;        break;
+			case RegisterOp::NotEqual:         name = "NOT EQUAL";           layout = Layout::ABC;        break;
+			case RegisterOp::GreaterEqual:     name = "GREATER EQUAL";       layout = Layout::ABC;        break;
+			case RegisterOp::LessEqual:        name = "LESS EQUAL";          layout = Layout::ABC;        break;
+			case RegisterOp::Add:              name = "ADD";                 layout = Layout::ABC;        break;
+			case RegisterOp::Sub:              name = "SUB";                 layout = Layout::ABC;        break;
+			case RegisterOp::Div:              name = "DIV";                 layout = Layout::ABC;        break;
+			case RegisterOp::Mul:              name = "MUL";                 layout = Layout::ABC;        break;
+			case RegisterOp::Mod:              name = "MOD";                 layout = Layout::ABC;        break;
+			case RegisterOp::BitAnd:           name = "BIT AND";             layout = Layout::ABC;        break;
+			case RegisterOp::BitOr:            name = "BIT OR";              layout = Layout::ABC;        break;
+			case RegisterOp::BitXor:           name = "BIT XOR";             layout = Layout::ABC;        break;
+			case RegisterOp::ShiftLeft:        name = "SHIFT LEFT";          layout = Layout::ABC;        break;
+			case RegisterOp::ShiftRight:       name = "SHIFT RIGHT";         layout = Layout::ABC;        break;
+			case RegisterOp::Negate:           name = "NEGATE";              layout = Layout::AB;         break;
+			case RegisterOp::Not:              name = "NOT";                 layout = Layout::AB;         break;
+			case RegisterOp::Jmp:              name = "JMP";                 layout = Layout::Target;     break;
+			case RegisterOp::JumpIfFalse:      name = "JUMP IF FALSE";       layout = Layout::RKTarget;   break;
+			case RegisterOp::JumpIfTrue:       name = "JUMP IF TRUE";        layout = Layout::RKTarget;   break;
+			case RegisterOp::JumpIfNotLess:    name = "JUMP IF NOT LESS";    layout = Layout::RKRKTarget; break;
+			case RegisterOp::JumpIfNotGreater: name = "JUMP IF NOT GREATER"; layout = Layout::RKRKTarget; break;
+			case RegisterOp::JumpIfLess:       name = "JUMP IF LESS";        layout = Layout::RKRKTarget; break;
+			case RegisterOp::JumpIfGreater:    name = "JUMP IF GREATER";     layout = Layout::RKRKTarget; break;
+			case RegisterOp::JumpIfEqual:      name = "JUMP IF EQUAL";       layout = Layout::RKRKTarget; break;
+			case RegisterOp::JumpIfNotEqual:   name = "JUMP IF NOT EQUAL";   layout = Layout::RKRKTarget; break;
+			case RegisterOp::DefineGlobal:     name = "DEFINE GLOBAL";       layout = Layout::RKIndex;    break;
+			case RegisterOp::GetGlobal:        name = "GET GLOBAL";          layout = Layout::AIndex;     break;
+			case RegisterOp::SetGlobal:        name = "SET GLOBAL";          layout = Layout::RKIndex;    break;
+			case RegisterOp::GetUpvalue:       name = "GET UPVALUE";         layout = Layout::AIndex;     break;
+			case RegisterOp::SetUpvalue:       name = "SET UPVALUE";         layout = Layout::RKIndex;    break;
+			case RegisterOp::CloseUpvalues:    name = "CLOSE UPVALUES";      layout = Layout::A;          break;
+			case RegisterOp::Closure:          name = "CLOSURE";             layout = Layout::AConstant;  break;
+			case RegisterOp::Print:            name = "PRINT";               layout = Layout::RK;         break;
+			case RegisterOp::Call:             name = "CALL";                layout = Layout::ACount;     break;
+			case RegisterOp::TailCall:         name = "TAIL CALL";           layout = Layout::ACount;     break;
+			case RegisterOp::Return:           name = "RETURN";              layout = Layout::RK;         break;
+		}
+
+		printf("OPCODE: %-16s ", name);
+
+		switch (layout) {
+			case Layout::A:
+				printf("r%u", instruction.a);
+				break;
+			case Layout::AB:
+				printf("r%u, ", instruction.a);
+				register_operand(instruction.b, block);
+				break;
+			case Layout::AConstant:
+				printf("r%u, ", instruction.a);
+				register_operand(REGISTER_CONSTANT | instruction.b, block);
+				break;
+			case Layout::ABC:
+				printf("r%u, ", instruction.a);
+				register_operand(instruction.b, block);
+				printf(", ");
+				register_operand(instruction.c, block);
+				break;
+			case Layout::RK:
+				register_operand(instruction.a, block);
+				break;
+			case Layout::RKIndex:
+				register_operand(instruction.a, block);
+				printf(", %u", instruction.b);
+				break;
+			case Layout::AIndex:
+				printf("r%u, %u", instruction.a, instruction.b);
+				break;
+			case Layout::Target:
+				printf("-> %u", instruction.a);
+				break;
+			case Layout::RKTarget:
+				register_operand(instruction.a, block);
+				printf(" -> %u", instruction.b);
+				break;
+			case Layout::RKRKTarget:
+				register_operand(instruction.a, block);
+				printf(", ");
+				register_operand(instruction.b, block);
+				printf(" -> %u", instruction.c);
+				break;
+			case Layout::ACount:
+				printf("r%u, %u", instruction.a, instruction.b);
+				break;
+		}
+
+		printf("\n");
+		return index + 1;
+	}
+
+	void Disassembler::register_operand(uint32_t operand, const ByteBlock* block)
+	{
+		if (operand & REGISTER_CONSTANT) {
+			printf("k%u '", operand & ~REGISTER_CONSTANT);
+			block->constants[operand & ~REGISTER_CONSTANT].print(false);
+			printf("'");
+		}
+		else {
+			printf("r%u", operand);
+		}
+	}
+
 }
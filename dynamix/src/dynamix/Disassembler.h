@@ -1,6 +1,7 @@
 #pragma once
 
 #include "ByteBlock.h"
+#include "RegisterBlock.h"
 
 namespace dynamix {
 
@@ -12,8 +13,17 @@ namespace dynamix {
 
 		static int32_t simple_instruction(const char* name, int32_t offset);
 		static int32_t constant_instruction(const char* name, ByteBlock* block, int32_t offset);
+		static int32_t constant_long_instruction(const char* name, ByteBlock* block, int32_t offset);
 		static int32_t byte_instruction(const char* name, ByteBlock* block, int32_t offset);
+		static int32_t long_instruction(const char* name, ByteBlock* block, int32_t offset);
 		static int32_t jump_instruction(const char* name, int32_t sign, ByteBlock* block, int32_t offset);
+		static int32_t long_jump_instruction(const char* name, int32_t sign, ByteBlock* block, int32_t offset);
+		static int32_t closure_instruction(const char* name, uint32_t constant, int32_t length, ByteBlock* block, int32_t offset);
+		static int32_t compare_jump_instruction(const char* name, ByteBlock* block, int32_t offset);
+
+		static void disassemble_registers(const RegisterBlock* registers, const ByteBlock* block, const char* name);
+		static int32_t disassemble_register_instruction(const RegisterBlock* registers, const ByteBlock* block, int32_t index);
+		static void register_operand(uint32_t operand, const ByteBlock* block);
 	};
 
 }
@@ -0,0 +1,31 @@
+#include "Globals.h"
+
+namespace dynamix {
+
+	uint32_t Globals::resolve(ObjString* name)
+	{
+		auto [slot, inserted] = m_Slots.try_emplace(name, (uint32_t)m_Names.size());
+		if (inserted) {
+			m_Names.push_back(name);
+			m_Values.push_back(Value::undefined());
+		}
+
+		return slot->second;
+	}
+
+	ObjString* Globals::name_of(uint32_t slot) const
+	{
+		return m_Names[slot];
+	}
+
+	Value* Globals::values()
+	{
+		return m_Values.data();
+	}
+
+	size_t Globals::size() const
+	{
+		return m_Names.size();
+	}
+
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include "Value.h"
+#include "Object.h"
+
+#include <unordered_map>
+#include <vector>
+#include <cstdint>
+
+namespace dynamix {
+
+	// Global variables live in a flat array owned by the VM. The compiler gives
+	// every global name a stable slot the first time it sees it, so the interpreter
+	// only ever indexes the array. Slots start out undefined; the names are only
+	// kept around to report errors.
+	class Globals
+	{
+	public:
+		uint32_t resolve(ObjString* name);
+
+		ObjString* name_of(uint32_t slot) const;
+		Value* values();
+		size_t size() const;
+
+	private:
+		std::unordered_map<ObjString*, uint32_t, ObjStringHash> m_Slots;
+		std::vector<ObjString*> m_Names;
+		std::vector<Value> m_Values;
+	};
+
+}
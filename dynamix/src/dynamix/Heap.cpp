@@ -0,0 +1,315 @@
+#include "Heap.h"
+
+#include "dynamix.h"
+#include "Object.h"
+
+#include <algorithm>
+#include <new>
+
+namespace dynamix {
+
+#define GC_INITIAL_THRESHOLD (1024 * 1024)
+#define GC_HEAP_GROW_FACTOR 2
+
+	Heap::Heap()
+	{
+		m_NextGC = GC_INITIAL_THRESHOLD;
+	}
+
+	Heap::~Heap()
+	{
+		// only functions and closures own memory of their own, the objects themselves
+		// go all at once with the allocator's slabs
+		Obj* object = m_Objects;
+		while (object) {
+			Obj* next = object->next;
+			if (object->type == ObjType::Function) {
+				((ObjFunction*)object)->~ObjFunction();
+			}
+			else if (object->type == ObjType::Closure) {
+				((ObjClosure*)object)->~ObjClosure();
+			}
+			object = next;
+		}
+	}
+
+	static uint32_t hash_string(std::string_view string)
+	{
+		uint32_t hash = 2166136261u;
+		for (char c : string) {
+			hash ^= (uint8_t)c;
+			hash *= 16777619u;
+		}
+
+		return hash;
+	}
+
+	size_t Heap::StringHash::operator()(std::string_view string) const
+	{
+		return hash_string(string);
+	}
+
+	ObjString* Heap::intern_string(std::string_view string)
+	{
+		auto interned = m_Strings.find(string);
+		if (interned != m_Strings.end()) {
+			return interned->second;
+		}
+
+		ObjString* result = allocate_object<ObjString>(ObjType::String, sizeof(ObjString) + string.size(), string.size());
+		std::copy(string.begin(), string.end(), (char*)result->chars());
+		result->hash = hash_string(string);
+		result->length = string.size();
+
+		m_Strings.emplace(result->view(), result);
+		return result;
+	}
+
+	ObjString* Heap::new_rope(ObjString* left, ObjString* right)
+	{
+		ObjString* result = allocate_object<ObjString>(ObjType::String, sizeof(ObjString));
+		result->length = left->length + right->length;
+		result->left = left;
+		result->right = right;
+		return result;
+	}
+
+	void Heap::flatten(Obj* object)
+	{
+		if (object->type != ObjType::String) {
+			return;
+		}
+
+		ObjString* string = (ObjString*)object;
+		if (string->flat()) {
+			return;
+		}
+
+		string->left = intern_string(string->text());
+		string->right = nullptr;
+	}
+
+	std::string ObjString::text() const
+	{
+		if (const ObjString* string = flat()) {
+			return std::string(string->view());
+		}
+
+		// appending in a loop nests ropes as deep as the loop ran, so walk them with
+		// an explicit stack
+		std::string text;
+		text.reserve(length);
+		std::vector<const ObjString*> pending{ right, left };
+		while (!pending.empty()) {
+			const ObjString* string = pending.back();
+			pending.pop_back();
+
+			if (const ObjString* flat = string->flat()) {
+				text.append(flat->view());
+			}
+			else {
+				pending.push_back(string->right);
+				pending.push_back(string->left);
+			}
+		}
+
+		return text;
+	}
+
+	ObjFunction* Heap::new_function()
+	{
+		ObjFunction* result = allocate_object<ObjFunction>(ObjType::Function, sizeof(ObjFunction));
+		result->arity = 0;
+		result->block = ByteBlock();
+		result->name = "";
+		return result;
+	}
+
+	ObjClosure* Heap::new_closure(ObjFunction* function)
+	{
+		ObjClosure* result = allocate_object<ObjClosure>(ObjType::Closure, sizeof(ObjClosure) + function->captures.size() * sizeof(ObjUpvalue*));
+		result->function = function;
+		result->upvalues.reserve(function->captures.size());
+		return result;
+	}
+
+	ObjUpvalue* Heap::new_upvalue(Value* slot)
+	{
+		ObjUpvalue* result = allocate_object<ObjUpvalue>(ObjType::Upvalue, sizeof(ObjUpvalue));
+		result->location = slot;
+		result->closed = Value(nullptr);
+		return result;
+	}
+
+	bool Heap::should_collect() const
+	{
+#if DEBUG_STRESS_GC
+		return true;
+#else
+		return m_BytesAllocated > m_NextGC;
+#endif
+	}
+
+	void Heap::mark_value(Value value)
+	{
+		if (value.is_object()) {
+			mark_object(value.as_object());
+		}
+	}
+
+	void Heap::mark_object(Obj* object)
+	{
+		if (!object || object->is_marked) {
+			return;
+		}
+
+		object->is_marked = true;
+		m_GrayStack.push_back(object);
+	}
+
+	void Heap::trace_references()
+	{
+		while (!m_GrayStack.empty()) {
+			Obj* object = m_GrayStack.back();
+			m_GrayStack.pop_back();
+			blacken_object(object);
+		}
+	}
+
+	void Heap::sweep()
+	{
+#if DEBUG_LOG_GC
+		size_t before = m_BytesAllocated;
+#endif
+
+		remove_unmarked_strings();
+
+		Obj** link = &m_Objects;
+		while (Obj* object = *link) {
+			if (object->is_marked) {
+				object->is_marked = false;
+				link = &object->next;
+				continue;
+			}
+
+			*link = object->next;
+			free_object(object);
+		}
+
+		m_NextGC = std::max<size_t>(m_BytesAllocated * GC_HEAP_GROW_FACTOR, GC_INITIAL_THRESHOLD);
+
+#if DEBUG_LOG_GC
+		printf("-- gc: collected %zu bytes (from %zu to %zu), next at %zu\n",
+			before - m_BytesAllocated, before, m_BytesAllocated, m_NextGC);
+#endif
+	}
+
+	size_t Heap::bytes_allocated() const
+	{
+		return m_BytesAllocated;
+	}
+
+	const AllocatorStats& Heap::allocator_stats() const
+	{
+		return m_Allocator.stats();
+	}
+
+	template <typename T>
+	T* Heap::allocate_object(ObjType type, size_t size, size_t trailing)
+	{
+		// `trailing` bytes are allocated along with the object, right after it
+		T* object = new (m_Allocator.allocate(sizeof(T) + trailing)) T();
+		object->type = type;
+		object->next = m_Objects;
+		m_Objects = object;
+
+		m_BytesAllocated += size;
+		return object;
+	}
+
+	void Heap::remove_unmarked_strings()
+	{
+		// the intern table holds its strings weakly, drop the ones about to be freed
+		for (auto it = m_Strings.begin(); it != m_Strings.end();) {
+			if (!it->second->is_marked) {
+				it = m_Strings.erase(it);
+			}
+			else {
+				++it;
+			}
+		}
+	}
+
+	void Heap::blacken_object(Obj* object)
+	{
+		switch (object->type) {
+			case ObjType::Function: {
+				ObjFunction* function = (ObjFunction*)object;
+				for (const Value& constant : function->block.constants) {
+					mark_value(constant);
+				}
+			} break;
+			case ObjType::String: {
+				ObjString* string = (ObjString*)object;
+				mark_object(string->left);
+				mark_object(string->right);
+			} break;
+			case ObjType::Closure: {
+				ObjClosure* closure = (ObjClosure*)object;
+				mark_object(closure->function);
+				for (ObjUpvalue* upvalue : closure->upvalues) {
+					mark_object(upvalue);
+				}
+			} break;
+			case ObjType::Upvalue:
+				mark_value(((ObjUpvalue*)object)->closed);
+				break;
+		}
+	}
+
+	size_t Heap::object_size(const Obj* object) const
+	{
+		switch (object->type) {
+			case ObjType::Function: return sizeof(ObjFunction);
+			case ObjType::String: {
+				const ObjString* string = (const ObjString*)object;
+				return sizeof(ObjString) + (string->is_rope() ? 0 : string->length);
+			}
+			case ObjType::Closure:  return sizeof(ObjClosure) + ((const ObjClosure*)object)->upvalues.size() * sizeof(ObjUpvalue*);
+			case ObjType::Upvalue:  return sizeof(ObjUpvalue);
+		}
+
+		// unreachable
+		return 0;
+	}
+
+	void Heap::free_object(Obj* object)
+	{
+		m_BytesAllocated -= object_size(object);
+
+		// the size it was allocated with, unlike `object_size` this leaves out memory the object owns
+		size_t size = 0;
+		switch (object->type) {
+			case ObjType::Function:
+				size = sizeof(ObjFunction);
+				((ObjFunction*)object)->~ObjFunction();
+				break;
+			case ObjType::String: {
+				ObjString* string = (ObjString*)object;
+				size = sizeof(ObjString) + (string->is_rope() ? 0 : string->length);
+				string->~ObjString();
+			} break;
+			case ObjType::Closure:
+				size = sizeof(ObjClosure);
+				((ObjClosure*)object)->~ObjClosure();
+				break;
+			case ObjType::Upvalue:
+				size = sizeof(ObjUpvalue);
+				((ObjUpvalue*)object)->~ObjUpvalue();
+				break;
+		}
+
+		m_Allocator.free(object, size);
+	}
+
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include "Value.h"
+#include "SlabAllocator.h"
+
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+#include <cstdint>
+
+namespace dynamix {
+
+	class Heap
+	{
+	public:
+		Heap();
+		~Heap();
+
+		ObjString* intern_string(std::string_view string);
+		ObjString* new_rope(ObjString* left, ObjString* right);
+		void flatten(Obj* object);
+		ObjFunction* new_function();
+		ObjClosure* new_closure(ObjFunction* function);
+		ObjUpvalue* new_upvalue(Value* slot);
+
+		bool should_collect() const;
+
+		void mark_value(Value value);
+		void mark_object(Obj* object);
+		void trace_references();
+		void sweep();
+
+		size_t bytes_allocated() const;
+		const AllocatorStats& allocator_stats() const;
+
+	private:
+		template <typename T>
+		T* allocate_object(ObjType type, size_t size, size_t trailing = 0);
+
+		void remove_unmarked_strings();
+		void blacken_object(Obj* object);
+		size_t object_size(const Obj* object) const;
+		void free_object(Obj* object);
+
+	private:
+		struct StringHash
+		{
+			size_t operator()(std::string_view string) const;
+		};
+
+		SlabAllocator m_Allocator; // destroyed last, taking the memory of every object with it
+		Obj* m_Objects = nullptr;
+		std::unordered_map<std::string_view, ObjString*, StringHash> m_Strings; // keys view the strings' own characters
+		std::vector<Obj*> m_GrayStack;
+
+		size_t m_BytesAllocated = 0;
+		size_t m_NextGC = 0;
+	};
+
+}
@@ -0,0 +1,550 @@
+#include "Ir.h"
+
+#include "ByteBlock.h"
+#include "Peephole.h"
+
+#include <algorithm>
+
+namespace dynamix {
+
+	IrFunction IrFunction::lift(ObjFunction* function)
+	{
+		const ByteBlock* block = &function->block;
+		const int32_t size = (int32_t)block->bytes.size();
+
+		IrFunction ir;
+		ir.function = function;
+
+		// a block starts at the beginning, at every jump target and after every transfer of control
+		std::vector<bool> is_leader(size + 1, false);
+		is_leader[0] = true;
+		for (int32_t offset = 0; offset < size;) {
+			OpCode instruction = (OpCode)block->bytes[offset];
+			int32_t next = offset + instruction_length(instruction);
+			if (Peephole::is_jump(instruction)) {
+				is_leader[Peephole::jump_target(block, offset)] = true;
+				is_leader[next] = true;
+			}
+			else if (instruction == OpCode::Return || instruction == OpCode::TailCall) {
+				is_leader[next] = true;
+			}
+
+			offset = next;
+		}
+
+		std::vector<uint32_t> block_at(size + 1, 0);
+		uint32_t block_count = 0;
+		for (int32_t offset = 0; offset <= size; offset++) {
+			if (is_leader[offset]) {
+				block_count++;
+			}
+
+			block_at[offset] = block_count - 1;
+		}
+
+		ir.blocks.resize(block_count);
+
+		// the stack depth where control joins is the one of the jump leading there
+		std::vector<int32_t> target_depth(size + 1, -1);
+
+		// the short forms carry their constant in the opcode, registers read it from the pool
+		uint32_t integer_constants[2] = { UINT32_MAX, UINT32_MAX };
+		auto integer_constant = [&](int64_t integer) {
+			if (integer_constants[integer] == UINT32_MAX) {
+				integer_constants[integer] = REGISTER_CONSTANT | (uint32_t)function->block.add_constant(Value(integer));
+			}
+			return integer_constants[integer];
+		};
+
+		uint32_t depth = function->arity + 1;
+		uint32_t max_depth = depth;
+		bool reachable = true;
+
+		for (int32_t offset = 0; offset < size;) {
+			OpCode instruction = (OpCode)block->bytes[offset];
+			int32_t length = instruction_length(instruction);
+			const uint8_t* operands = block->bytes.data() + offset + 1;
+			uint32_t operand = length == 4 ? (operands[0] << 16) | (operands[1] << 8) | operands[2] : length > 1 ? operands[0] : 0;
+
+			if (is_leader[offset] && !reachable && target_depth[offset] >= 0) {
+				depth = target_depth[offset];
+			}
+			reachable = true;
+
+			std::vector<IrInstruction>& out = ir.blocks[block_at[offset]].instructions;
+			uint32_t line = block->lines[offset];
+			auto emit = [&](RegisterOp op, uint32_t a, uint32_t b = 0, uint32_t c = 0) {
+				out.push_back(IrInstruction{ op, a, b, c, line });
+			};
+			auto jump_to = [&](int32_t from) {
+				int32_t target = Peephole::jump_target(block, from);
+				target_depth[target] = depth;
+				return block_at[target];
+			};
+
+			switch (instruction) {
+				case OpCode::PushConstant:
+				case OpCode::PushConstantLong:
+					emit(RegisterOp::Move, depth++, REGISTER_CONSTANT | operand);
+					break;
+				case OpCode::PushZero: emit(RegisterOp::Move, depth++, integer_constant(0)); break;
+				case OpCode::PushOne:  emit(RegisterOp::Move, depth++, integer_constant(1)); break;
+				case OpCode::Pop: depth--; break;
+				case OpCode::Null:  emit(RegisterOp::LoadNull, depth++);  break;
+				case OpCode::True:  emit(RegisterOp::LoadTrue, depth++);  break;
+				case OpCode::False: emit(RegisterOp::LoadFalse, depth++); break;
+				case OpCode::Equal:
+				case OpCode::Greater:
+				case OpCode::Less:
+				case OpCode::NotEqual:
+				case OpCode::GreaterEqual:
+				case OpCode::LessEqual:
+				case OpCode::Add:
+				case OpCode::Sub:
+				case OpCode::Div:
+				case OpCode::Mul:
+				case OpCode::Mod:
+				case OpCode::BitAnd:
+				case OpCode::BitOr:
+				case OpCode::BitXor:
+				case OpCode::ShiftLeft:
+				case OpCode::ShiftRight: {
+					// both instruction sets list the binary operators in the same order
+					RegisterOp op = (RegisterOp)((int32_t)RegisterOp::Equal + ((int32_t)instruction - (int32_t)OpCode::Equal));
+					depth--;
+					emit(op, depth - 1, depth - 1, depth);
+				} break;
+				case OpCode::GreaterUnchecked:
+				case OpCode::LessUnchecked:
+				case OpCode::GreaterEqualUnchecked:
+				case OpCode::LessEqualUnchecked:
+				case OpCode::AddUnchecked:
+				case OpCode::SubUnchecked:
+				case OpCode::DivUnchecked:
+				case OpCode::MulUnchecked: {
+					// the register instructions check their operands either way
+					static constexpr RegisterOp checked[] = {
+						RegisterOp::Greater, RegisterOp::Less, RegisterOp::GreaterEqual, RegisterOp::LessEqual,
+						RegisterOp::Add, RegisterOp::Sub, RegisterOp::Div, RegisterOp::Mul,
+					};
+					RegisterOp op = checked[(int32_t)instruction - (int32_t)OpCode::GreaterUnchecked];
+					depth--;
+					emit(op, depth - 1, depth - 1, depth);
+				} break;
+				case OpCode::Negate: emit(RegisterOp::Negate, depth - 1, depth - 1); break;
+				case OpCode::Not:    emit(RegisterOp::Not, depth - 1, depth - 1);    break;
+				case OpCode::Jmp:
+				case OpCode::JmpLong:
+				case OpCode::Loop:
+				case OpCode::LoopLong:
+					emit(RegisterOp::Jmp, jump_to(offset));
+					reachable = false;
+					break;
+				case OpCode::Jz:
+				case OpCode::JzLong:
+					emit(RegisterOp::JumpIfFalse, depth - 1, jump_to(offset));
+					break;
+				case OpCode::JumpIfFalsePop:
+				case OpCode::JumpIfFalsePopLong:
+					depth--;
+					emit(RegisterOp::JumpIfFalse, depth, jump_to(offset));
+					break;
+				case OpCode::JumpIfTruePop:
+				case OpCode::JumpIfTruePopLong:
+					depth--;
+					emit(RegisterOp::JumpIfTrue, depth, jump_to(offset));
+					break;
+				case OpCode::JumpIfNotLess:
+				case OpCode::JumpIfNotGreater:
+				case OpCode::JumpIfLess:
+				case OpCode::JumpIfGreater: {
+					RegisterOp op = (RegisterOp)((int32_t)RegisterOp::JumpIfNotLess + ((int32_t)instruction - (int32_t)OpCode::JumpIfNotLess));
+					emit(op, operands[0], REGISTER_CONSTANT | operands[1], jump_to(offset));
+				} break;
+				case OpCode::DefineGlobal:
+				case OpCode::DefineGlobalLong:
+					emit(RegisterOp::DefineGlobal, --depth, operand);
+					break;
+				case OpCode::GetGlobal:
+				case OpCode::GetGlobalLong:
+					emit(RegisterOp::GetGlobal, depth++, operand);
+					break;
+				case OpCode::SetGlobal:
+				case OpCode::SetGlobalLong:
+					emit(RegisterOp::SetGlobal, depth - 1, operand);
+					break;
+				case OpCode::GetLocal:
+				case OpCode::GetLocalLong:
+					emit(RegisterOp::Move, depth++, operand);
+					break;
+				case OpCode::SetLocal:
+				case OpCode::SetLocalLong:
+					emit(RegisterOp::Move, operand, depth - 1);
+					break;
+				case OpCode::StoreLocalPop:
+					emit(RegisterOp::Move, operand, --depth);
+					break;
+				case OpCode::GetLocal0:
+				case OpCode::GetLocal1:
+				case OpCode::GetLocal2:
+				case OpCode::GetLocal3:
+					emit(RegisterOp::Move, depth++, (uint32_t)instruction - (uint32_t)OpCode::GetLocal0);
+					break;
+				case OpCode::SetLocal0:
+				case OpCode::SetLocal1:
+				case OpCode::SetLocal2:
+				case OpCode::SetLocal3:
+					emit(RegisterOp::Move, (uint32_t)instruction - (uint32_t)OpCode::SetLocal0, depth - 1);
+					break;
+				case OpCode::IncLocal:
+					emit(RegisterOp::Add, operand, operand, integer_constant(1));
+					break;
+				case OpCode::GetUpvalue: emit(RegisterOp::GetUpvalue, depth++, operand);  break;
+				case OpCode::SetUpvalue: emit(RegisterOp::SetUpvalue, depth - 1, operand); break;
+				case OpCode::CloseUpvalue:
+					emit(RegisterOp::CloseUpvalues, --depth);
+					break;
+				case OpCode::Closure:
+				case OpCode::ClosureLong:
+					emit(RegisterOp::Closure, depth++, operand);
+					break;
+				case OpCode::Print:
+					emit(RegisterOp::Print, --depth);
+					break;
+				case OpCode::Call:
+				case OpCode::TailCall:
+					depth -= operand + 1;
+					emit(instruction == OpCode::Call ? RegisterOp::Call : RegisterOp::TailCall, depth++, operand);
+					reachable = instruction == OpCode::Call;
+					break;
+				case OpCode::Return:
+					emit(RegisterOp::Return, --depth);
+					reachable = false;
+					break;
+				case OpCode::GreaterNumNum:
+				case OpCode::LessNumNum:
+				case OpCode::GreaterEqualNumNum:
+				case OpCode::LessEqualNumNum:
+				case OpCode::AddNumNum:
+				case OpCode::SubNumNum:
+				case OpCode::DivNumNum:
+				case OpCode::MulNumNum:
+					// unreachable, the stack machine only rewrites its bytecode to these once it runs
+					__debugbreak();
+					break;
+			}
+
+			max_depth = std::max(max_depth, depth);
+			offset += length;
+		}
+
+		ir.register_count = max_depth;
+		ir.escaping.assign(max_depth, false);
+		for (const IrBlock& ir_block : ir.blocks) {
+			for (const IrInstruction& instruction : ir_block.instructions) {
+				if (instruction.op != RegisterOp::Closure) {
+					continue;
+				}
+
+				for (const UpvalueCapture& capture : block->constants[instruction.b].as_function()->captures) {
+					if (capture.is_local) {
+						ir.escaping[capture.index] = true;
+					}
+				}
+			}
+		}
+
+		return ir;
+	}
+
+	void IrFunction::lower(RegisterBlock* registers) const
+	{
+		*registers = RegisterBlock();
+		registers->register_count = register_count;
+
+		// a jump to the block right after it falls through instead
+		auto is_fallthrough = [&](uint32_t block, const IrInstruction& instruction) {
+			return instruction.op == RegisterOp::Jmp && instruction.a == block + 1;
+		};
+
+		std::vector<uint32_t> block_start(blocks.size() + 1, 0);
+		uint32_t index = 0;
+		for (uint32_t block = 0; block < blocks.size(); block++) {
+			block_start[block] = index;
+			for (const IrInstruction& instruction : blocks[block].instructions) {
+				index += is_fallthrough(block, instruction) ? 0 : 1;
+			}
+		}
+		block_start[blocks.size()] = index;
+
+		for (uint32_t block = 0; block < blocks.size(); block++) {
+			for (IrInstruction instruction : blocks[block].instructions) {
+				if (is_fallthrough(block, instruction)) {
+					continue;
+				}
+
+				if (is_jump(instruction.op)) {
+					jump_target(instruction) = block_start[jump_target(instruction)];
+				}
+
+				registers->write(RegisterInstruction{ instruction.op, instruction.a, instruction.b, instruction.c }, instruction.line);
+			}
+		}
+	}
+
+	uint32_t IrFunction::add_register()
+	{
+		escaping.push_back(false);
+		return register_count++;
+	}
+
+	std::vector<uint32_t> IrFunction::successors(uint32_t block) const
+	{
+		std::vector<uint32_t> result;
+		const std::vector<IrInstruction>& instructions = blocks[block].instructions;
+
+		IrInstruction last = instructions.empty() ? IrInstruction{ RegisterOp::Move } : instructions.back();
+		if (is_jump(last.op)) {
+			result.push_back(jump_target(last));
+		}
+
+		if (!ends_block(last.op) && block + 1 < blocks.size()) {
+			result.push_back(block + 1);
+		}
+
+		return result;
+	}
+
+	std::vector<std::vector<bool>> IrFunction::live_out() const
+	{
+		std::vector<std::vector<bool>> live_in(blocks.size(), std::vector<bool>(register_count, false));
+		std::vector<std::vector<bool>> live_out(blocks.size(), std::vector<bool>(register_count, false));
+
+		bool changed = true;
+		while (changed) {
+			changed = false;
+
+			for (uint32_t block = (uint32_t)blocks.size(); block-- > 0;) {
+				std::vector<bool> live(register_count, false);
+				for (uint32_t successor : successors(block)) {
+					for (uint32_t reg = 0; reg < register_count; reg++) {
+						if (live_in[successor][reg]) {
+							live[reg] = true;
+						}
+					}
+				}
+				live_out[block] = live;
+
+				for (auto it = blocks[block].instructions.rbegin(); it != blocks[block].instructions.rend(); ++it) {
+					uint32_t reg;
+					if (defined_register(*it, &reg)) {
+						live[reg] = false;
+					}
+					mark_uses(*this, *it, live);
+				}
+
+				if (live != live_in[block]) {
+					live_in[block].swap(live);
+					changed = true;
+				}
+			}
+		}
+
+		return live_out;
+	}
+
+	bool is_jump(RegisterOp op)
+	{
+		switch (op) {
+			case RegisterOp::Jmp:
+			case RegisterOp::JumpIfFalse:
+			case RegisterOp::JumpIfTrue:
+			case RegisterOp::JumpIfNotLess:
+			case RegisterOp::JumpIfNotGreater:
+			case RegisterOp::JumpIfLess:
+			case RegisterOp::JumpIfGreater:
+			case RegisterOp::JumpIfEqual:
+			case RegisterOp::JumpIfNotEqual:
+				return true;
+			default:
+				return false;
+		}
+	}
+
+	uint32_t& jump_target(IrInstruction& instruction)
+	{
+		switch (instruction.op) {
+			case RegisterOp::Jmp:         return instruction.a;
+			case RegisterOp::JumpIfFalse:
+			case RegisterOp::JumpIfTrue:  return instruction.b;
+			default:                      return instruction.c;
+		}
+	}
+
+	bool ends_block(RegisterOp op)
+	{
+		return op == RegisterOp::Jmp || op == RegisterOp::Return || op == RegisterOp::TailCall;
+	}
+
+	bool reads_registers_of(RegisterOp op)
+	{
+		switch (op) {
+			case RegisterOp::Equal:
+			case RegisterOp::Greater:
+			case RegisterOp::Less:
+			case RegisterOp::NotEqual:
+			case RegisterOp::GreaterEqual:
+			case RegisterOp::LessEqual:
+			case RegisterOp::Add:
+			case RegisterOp::Sub:
+			case RegisterOp::Div:
+			case RegisterOp::Mul:
+			case RegisterOp::Mod:
+			case RegisterOp::BitAnd:
+			case RegisterOp::BitOr:
+			case RegisterOp::BitXor:
+			case RegisterOp::ShiftLeft:
+			case RegisterOp::ShiftRight:
+			case RegisterOp::Negate:
+			case RegisterOp::Not:
+				return true;
+			default:
+				return false;
+		}
+	}
+
+	bool is_side_effect_free(RegisterOp op)
+	{
+		// arithmetic and ordered comparisons report type errors at runtime
+		switch (op) {
+			case RegisterOp::Move:
+			case RegisterOp::LoadNull:
+			case RegisterOp::LoadTrue:
+			case RegisterOp::LoadFalse:
+			case RegisterOp::Equal:
+			case RegisterOp::NotEqual:
+			case RegisterOp::Not:
+			case RegisterOp::GetUpvalue:
+				return true;
+			default:
+				return false;
+		}
+	}
+
+	bool defined_register(const IrInstruction& instruction, uint32_t* reg)
+	{
+		switch (instruction.op) {
+			case RegisterOp::Move:
+			case RegisterOp::LoadNull:
+			case RegisterOp::LoadTrue:
+			case RegisterOp::LoadFalse:
+			case RegisterOp::Equal:
+			case RegisterOp::Greater:
+			case RegisterOp::Less:
+			case RegisterOp::NotEqual:
+			case RegisterOp::GreaterEqual:
+			case RegisterOp::LessEqual:
+			case RegisterOp::Add:
+			case RegisterOp::Sub:
+			case RegisterOp::Div:
+			case RegisterOp::Mul:
+			case RegisterOp::Mod:
+			case RegisterOp::BitAnd:
+			case RegisterOp::BitOr:
+			case RegisterOp::BitXor:
+			case RegisterOp::ShiftLeft:
+			case RegisterOp::ShiftRight:
+			case RegisterOp::Negate:
+			case RegisterOp::Not:
+			case RegisterOp::GetGlobal:
+			case RegisterOp::GetUpvalue:
+			case RegisterOp::Closure:
+			case RegisterOp::Call:
+				*reg = instruction.a;
+				return true;
+			default:
+				return false;
+		}
+	}
+
+	uint32_t read_operands(IrInstruction& instruction, uint32_t* operands[2])
+	{
+		switch (instruction.op) {
+			case RegisterOp::Move:
+			case RegisterOp::Negate:
+			case RegisterOp::Not:
+				operands[0] = &instruction.b;
+				return 1;
+			case RegisterOp::Equal:
+			case RegisterOp::Greater:
+			case RegisterOp::Less:
+			case RegisterOp::NotEqual:
+			case RegisterOp::GreaterEqual:
+			case RegisterOp::LessEqual:
+			case RegisterOp::Add:
+			case RegisterOp::Sub:
+			case RegisterOp::Div:
+			case RegisterOp::Mul:
+			case RegisterOp::Mod:
+			case RegisterOp::BitAnd:
+			case RegisterOp::BitOr:
+			case RegisterOp::BitXor:
+			case RegisterOp::ShiftLeft:
+			case RegisterOp::ShiftRight:
+				operands[0] = &instruction.b;
+				operands[1] = &instruction.c;
+				return 2;
+			case RegisterOp::JumpIfNotLess:
+			case RegisterOp::JumpIfNotGreater:
+			case RegisterOp::JumpIfLess:
+			case RegisterOp::JumpIfGreater:
+			case RegisterOp::JumpIfEqual:
+			case RegisterOp::JumpIfNotEqual:
+				operands[0] = &instruction.a;
+				operands[1] = &instruction.b;
+				return 2;
+			case RegisterOp::JumpIfFalse:
+			case RegisterOp::JumpIfTrue:
+			case RegisterOp::DefineGlobal:
+			case RegisterOp::SetGlobal:
+			case RegisterOp::SetUpvalue:
+			case RegisterOp::Print:
+			case RegisterOp::Return:
+				operands[0] = &instruction.a;
+				return 1;
+			default:
+				return 0;
+		}
+	}
+
+	void mark_uses(const IrFunction& function, const IrInstruction& instruction, std::vector<bool>& live)
+	{
+		IrInstruction copy = instruction;
+		uint32_t* operands[2];
+		uint32_t count = read_operands(copy, operands);
+		for (uint32_t i = 0; i < count; i++) {
+			if (is_register(*operands[i])) {
+				live[*operands[i]] = true;
+			}
+		}
+
+		switch (instruction.op) {
+			case RegisterOp::Call:
+			case RegisterOp::TailCall:
+				for (uint32_t reg = instruction.a; reg <= instruction.a + instruction.b; reg++) {
+					live[reg] = true;
+				}
+				break;
+			case RegisterOp::Closure:
+				for (const UpvalueCapture& capture : function.function->block.constants[instruction.b].as_function()->captures) {
+					if (capture.is_local && capture.index != instruction.a) {
+						live[capture.index] = true;
+					}
+				}
+				break;
+			default:
+				break;
+		}
+	}
+
+}
@@ -0,0 +1,81 @@
+#pragma once
+
+#include "RegisterBlock.h"
+#include "Object.h"
+
+#include <vector>
+#include <cstdint>
+
+namespace dynamix {
+
+	// An instruction of the intermediate representation. It uses the register
+	// backend's instruction set and operand encoding, except that jumps name the
+	// index of their target block instead of an instruction.
+	struct IrInstruction
+	{
+		RegisterOp op;
+		uint32_t a = 0;
+		uint32_t b = 0;
+		uint32_t c = 0;
+		uint32_t line = 0;
+	};
+
+	struct IrBlock
+	{
+		std::vector<IrInstruction> instructions;
+	};
+
+	// A function as a list of basic blocks over the registers of its slot window.
+	// Registers are not in SSA form: locals keep their slot and every temporary
+	// of the stack bytecode gets the register of its stack position.
+	struct IrFunction
+	{
+		ObjFunction* function = nullptr;
+		std::vector<IrBlock> blocks;
+		uint32_t register_count = 0;
+
+		// registers captured by a closure; callees may read and write them through
+		// upvalues, so their values are always observable
+		std::vector<bool> escaping;
+
+		// Lifts the stack bytecode of `function` one instruction at a time, every
+		// push and pop becoming an explicit move to or from a register.
+		static IrFunction lift(ObjFunction* function);
+
+		// Writes the blocks out in order as register code.
+		void lower(RegisterBlock* registers) const;
+
+		// A register above the slots of the stack bytecode, for values passes introduce.
+		uint32_t add_register();
+
+		std::vector<uint32_t> successors(uint32_t block) const;
+
+		// Registers live on exit of every block.
+		std::vector<std::vector<bool>> live_out() const;
+	};
+
+	bool is_jump(RegisterOp op);
+	uint32_t& jump_target(IrInstruction& instruction);
+	bool ends_block(RegisterOp op);
+
+	// Operators that compute their result from their operand registers and constants only.
+	bool reads_registers_of(RegisterOp op);
+
+	// Instructions that can neither fail nor be observed other than through their result.
+	bool is_side_effect_free(RegisterOp op);
+
+	// The register an instruction writes, if any. A call writes its result into the
+	// callee's register and additionally clobbers everything above it.
+	bool defined_register(const IrInstruction& instruction, uint32_t* reg);
+
+	// The operand fields an instruction reads that may hold a register or a
+	// constant and can be rewritten by passes.
+	uint32_t read_operands(IrInstruction& instruction, uint32_t* operands[2]);
+
+	// Adds every register an instruction reads, including the arguments of calls
+	// and the locals captured by closures, which are not explicit operands.
+	void mark_uses(const IrFunction& function, const IrInstruction& instruction, std::vector<bool>& live);
+
+	inline bool is_register(uint32_t operand) { return !(operand & REGISTER_CONSTANT); }
+
+}
@@ -1,34 +1,56 @@
 #include "Lexer.h"
 
 #include <format>
+#include <unordered_map>
 
 namespace dynamix {
+
+	static const std::unordered_map<std::string_view, TokenType> s_Keywords = {
+		{ "struct", TokenType::Struct },
+		{ "else",   TokenType::Else   },
+		{ "false",  TokenType::False  },
+		{ "for",    TokenType::For    },
+		{ "fun",    TokenType::Fun    },
+		{ "if",     TokenType::If     },
+		{ "null",   TokenType::Null   },
+		{ "print",  TokenType::Print  },
+		{ "return", TokenType::Return },
+		{ "super",  TokenType::Super  },
+		{ "self",   TokenType::Self   },
+		{ "true",   TokenType::True   },
+		{ "let",    TokenType::Let    },
+		{ "while",  TokenType::While  },
+	};
 	
-	Lexer::Lexer(const std::string& source)
+	Lexer::Lexer(const std::string& source, Arena& arena)
 		:
 		m_Source(source),
-		m_Start(source.c_str()),
-		m_Current(source.c_str()),
+		m_Start(m_Source.c_str()),
+		m_Current(m_Source.c_str()),
 		m_Line(1),
 		m_LineStart(m_Current),
-		m_Keywords({
-			{ "&&",     TokenType::And    },
-			{ "struct", TokenType::Struct },
-			{ "else",   TokenType::Else   },
-			{ "false",  TokenType::False  },
-			{ "for",    TokenType::For    },
-			{ "fun",    TokenType::Fun    },
-			{ "if",     TokenType::If     },
-			{ "null",   TokenType::Null   },
-			{ "||",     TokenType::Or     },
-			{ "print",  TokenType::Print  },
-			{ "return", TokenType::Return },
-			{ "super",  TokenType::Super  },
-			{ "self",   TokenType::Self   },
-			{ "true",   TokenType::True   },
-			{ "let",    TokenType::Let    },
-			{ "while",  TokenType::While  },
-		}) { }
+		m_Arena(arena) { }
+
+	void Lexer::reset()
+	{
+		m_Start = m_Source.c_str();
+		m_Current = m_Start;
+		m_LineStart = m_Start;
+		m_Line = 1;
+	}
+
+	Lexer::Checkpoint Lexer::checkpoint() const
+	{
+		return Checkpoint{ m_Current, m_LineStart, m_Line };
+	}
+
+	void Lexer::rewind(const Checkpoint& checkpoint)
+	{
+		m_Current = checkpoint.current;
+		m_Start = checkpoint.current;
+		m_LineStart = checkpoint.line_start;
+		m_Line = checkpoint.line;
+	}
 
 	Token Lexer::scan_token()
 	{
@@ -60,16 +82,19 @@ namespace dynamix {
 			case '+': return make_token(TokenType::Plus);
 			case '/': return make_token(TokenType::Slash);
 			case '*': return make_token(TokenType::Star);
+			case '%': return make_token(TokenType::Percent);
+			case '^': return make_token(TokenType::Caret);
 			case '!': return make_token(match('=') ? TokenType::BangEq : TokenType::Bang);
 			case '=': return make_token(match('=') ? TokenType::EqEq : TokenType::Eq);
-			case '<': return make_token(match('=') ? TokenType::Lte : TokenType::Lt);
-			case '>': return make_token(match('=') ? TokenType::Gte : TokenType::Gt);
+			case '<': return make_token(match('<') ? TokenType::LtLt : match('=') ? TokenType::Lte : TokenType::Lt);
+			case '>': return make_token(match('>') ? TokenType::GtGt : match('=') ? TokenType::Gte : TokenType::Gt);
+			case '&': return make_token(match('&') ? TokenType::And : TokenType::Amp);
+			case '|': return make_token(match('|') ? TokenType::Or : TokenType::Pipe);
 			case '"': return string();
 			case '\'': return character();
 		}
 
-		std::string error = std::format("Unexpected character '{}'", m_Start);
-		return error_token(error.c_str());
+		return error_token(std::format("Unexpected character '{}'", *m_Start));
 	}
 
 	Token Lexer::string()
@@ -163,10 +188,9 @@ namespace dynamix {
 
 	TokenType Lexer::identifier_type() const
 	{
-		std::string identifier(m_Start, m_Current);
-
-		if (m_Keywords.contains(identifier)) {
-			return m_Keywords.at(identifier);
+		auto keyword = s_Keywords.find(std::string_view(m_Start, m_Current - m_Start));
+		if (keyword != s_Keywords.end()) {
+			return keyword->second;
 		}
 
 		return TokenType::Ident;
@@ -214,14 +238,14 @@ namespace dynamix {
 	bool Lexer::is_digit(char c) const
 	{
 		return (c >= '0' && c <= '9')
-			|| std::string("_'").find(c) != std::string::npos;
+			|| c == '_' || c == '\'';
 	}
 
 	bool Lexer::is_alpha(char c) const
 	{
 		return (c >= 'a' && c <= 'z')
 			|| (c >= 'A' && c <= 'Z')
-			|| std::string("_&|").find(c) != std::string::npos;
+			|| c == '_';
 	}
 
 	bool Lexer::is_alnum(char c) const
@@ -240,19 +264,12 @@ namespace dynamix {
 		return token;
 	}
 
-	Token Lexer::error_token(const char* err)
+	Token Lexer::error_token(std::string_view err)
 	{
 		Token token;
 		token.type = TokenType::Error;
-		
-		size_t err_size = strlen(err);
-		char* error = (char*)malloc(err_size);
-		if (error) {
-			memcpy(error, err, err_size);
-		}
-
-		token.start = error;
-		token.length = (uint32_t)err_size;
+		token.start = m_Arena.copy(err).data();
+		token.length = (uint32_t)err.size();
 		token.column = (uint32_t)(m_Start - m_LineStart);
 		token.line = m_Line;
 		return token;
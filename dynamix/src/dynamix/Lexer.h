@@ -1,7 +1,9 @@
 #pragma once
 
+#include "Arena.h"
+
 #include <string>
-#include <unordered_map>
+#include <string_view>
 
 namespace dynamix {
 
@@ -12,19 +14,22 @@ namespace dynamix {
 		LBracket, RBracket,
 		Comma, Dot, Minus, Plus,
 		Semicolon, Slash, Star,
+		Percent, Caret,
 
 		// One or two character tokens.
 		Bang, BangEq,
 		Eq, EqEq,
-		Gt, Gte,
-		Lt, Lte,
+		Gt, Gte, GtGt,
+		Lt, Lte, LtLt,
+		Amp, And,
+		Pipe, Or,
 
 		// Literals.
 		Ident, String, Number, Char,
 
 		// Keywords.
-		And, Struct, Else, False,
-		For, Fun, If, Null, Or,
+		Struct, Else, False,
+		For, Fun, If, Null,
 		Print, Return, Super, Self,
 		True, Let, While,
 
@@ -43,9 +48,23 @@ namespace dynamix {
 	class Lexer
 	{
 	public:
-		Lexer(const std::string& source);
+		// A position in the source to scan from again.
+		struct Checkpoint
+		{
+			const char* current;
+			const char* line_start;
+			uint32_t line;
+		};
+
+	public:
+		// error tokens point at text kept in `arena`
+		Lexer(const std::string& source, Arena& arena);
 
 		Token scan_token();
+		void reset();
+
+		Checkpoint checkpoint() const;
+		void rewind(const Checkpoint& checkpoint);
 
 	private:
 		Token string();
@@ -67,7 +86,7 @@ namespace dynamix {
 		bool is_alnum(char c) const;
 
 		Token make_token(TokenType type);
-		Token error_token(const char* err);
+		Token error_token(std::string_view err);
 
 	private:
 		std::string m_Source;
@@ -75,7 +94,7 @@ namespace dynamix {
 		const char* m_Start;
 		const char* m_LineStart;
 		uint32_t m_Line;
-		std::unordered_map<std::string, TokenType> m_Keywords;
+		Arena& m_Arena;
 	};
 
 }
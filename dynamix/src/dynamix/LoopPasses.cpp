@@ -0,0 +1,656 @@
+#include "LoopPasses.h"
+
+#include <algorithm>
+#include <unordered_map>
+#include <cmath>
+
+namespace dynamix {
+
+	// loops at most this long are unrolled
+	static constexpr uint32_t MAX_UNROLLED_TRIPS = 8;
+	static constexpr size_t MAX_UNROLLED_INSTRUCTIONS = 64;
+
+	// loops at most this long are peeled to move invariants out of them
+	static constexpr size_t MAX_PEELED_INSTRUCTIONS = 128;
+
+	// every integer of smaller magnitude is exact in a double
+	static constexpr double MAX_EXACT_INTEGER = 9007199254740992.0;
+
+	static bool number_constant(const IrFunction& function, uint32_t operand, double* number, bool* is_integer = nullptr)
+	{
+		if (is_register(operand)) {
+			return false;
+		}
+
+		const Value& value = function.function->block.constants[operand & ~REGISTER_CONSTANT];
+		if (!value.is_numeric()) {
+			return false;
+		}
+
+		*number = value.to_double();
+		if (is_integer) {
+			*is_integer = value.is(ValueType::Integer);
+		}
+		return true;
+	}
+
+	// `number` is integral whenever `integer` is set
+	static uint32_t add_number(IrFunction* function, double number, bool integer)
+	{
+		Value value = integer ? Value((int64_t)number) : Value(number);
+		return REGISTER_CONSTANT | (uint32_t)function->function->block.add_constant(value);
+	}
+
+	static bool is_call(RegisterOp op)
+	{
+		return op == RegisterOp::Call || op == RegisterOp::TailCall;
+	}
+
+	// a call's window overwrites the registers above it, including the ones passes add
+	static bool has_calls(const IrFunction& function, const Loop& loop)
+	{
+		for (uint32_t block = loop.header; block <= loop.latch; block++) {
+			for (const IrInstruction& instruction : function.blocks[block].instructions) {
+				if (is_call(instruction.op)) {
+					return true;
+				}
+			}
+		}
+
+		return false;
+	}
+
+	// whether the loop runs again after the header compares `counter` with `limit`
+	static bool loop_continues(RegisterOp test, double counter, double limit)
+	{
+		switch (test) {
+			case RegisterOp::JumpIfNotLess:    return counter < limit;
+			case RegisterOp::JumpIfNotGreater: return counter > limit;
+			case RegisterOp::JumpIfLess:       return !(counter < limit);
+			case RegisterOp::JumpIfGreater:    return !(counter > limit);
+			default:                           return false;
+		}
+	}
+
+	std::vector<Loop> find_loops(const IrFunction& function)
+	{
+		std::vector<Loop> loops;
+		const std::vector<IrBlock>& blocks = function.blocks;
+
+		for (uint32_t latch = 0; latch < blocks.size(); latch++) {
+			const std::vector<IrInstruction>& instructions = blocks[latch].instructions;
+			if (instructions.empty() || instructions.back().op != RegisterOp::Jmp || instructions.back().a >= latch) {
+				continue;
+			}
+
+			uint32_t header = instructions.back().a;
+			if (blocks[header].instructions.empty()) {
+				continue;
+			}
+
+			IrInstruction test = blocks[header].instructions.back();
+			if (!is_jump(test.op) || test.op == RegisterOp::Jmp || jump_target(test) != latch + 1) {
+				continue;
+			}
+
+			bool single_entry = true;
+			for (uint32_t block = 0; block < blocks.size() && single_entry; block++) {
+				if (block >= header && block <= latch) {
+					continue;
+				}
+
+				for (uint32_t successor : function.successors(block)) {
+					if (successor > header && successor <= latch) {
+						single_entry = false;
+					}
+				}
+			}
+
+			if (single_entry) {
+				loops.push_back(Loop{ header, latch });
+			}
+		}
+
+		std::sort(loops.begin(), loops.end(), [](const Loop& a, const Loop& b) { return a.header > b.header; });
+		return loops;
+	}
+
+	void for_each_loop(IrFunction* function, const std::function<void(const Loop&)>& visit)
+	{
+		// inserting blocks in front of a header only moves the loops visited before it
+		uint32_t next_header = (uint32_t)function->blocks.size();
+		for (;;) {
+			std::vector<Loop> loops = find_loops(*function);
+			auto next = std::find_if(loops.begin(), loops.end(), [&](const Loop& loop) { return loop.header < next_header; });
+			if (next == loops.end()) {
+				return;
+			}
+
+			next_header = next->header;
+			visit(*next);
+		}
+	}
+
+	bool find_counted_loop(const IrFunction& function, const Loop& loop, CountedLoop* counted)
+	{
+		const std::vector<IrBlock>& blocks = function.blocks;
+		const IrInstruction& test = blocks[loop.header].instructions.back();
+		switch (test.op) {
+			case RegisterOp::JumpIfNotLess:
+			case RegisterOp::JumpIfNotGreater:
+			case RegisterOp::JumpIfLess:
+			case RegisterOp::JumpIfGreater:
+				break;
+			default:
+				return false;
+		}
+
+		uint32_t counter = test.a;
+		if (!is_register(counter) || function.escaping[counter] || !number_constant(function, test.b, &counted->limit)) {
+			return false;
+		}
+
+		counted->counter = counter;
+		counted->test = test.op;
+
+		// the counter only changes by a constant step in the latch
+		bool found_increment = false;
+		for (uint32_t block = loop.header; block <= loop.latch; block++) {
+			const std::vector<IrInstruction>& instructions = blocks[block].instructions;
+			for (size_t i = 0; i < instructions.size(); i++) {
+				const IrInstruction& instruction = instructions[i];
+				if (is_call(instruction.op) && instruction.a <= counter) {
+					return false;
+				}
+
+				uint32_t reg;
+				if (!defined_register(instruction, &reg) || reg != counter) {
+					continue;
+				}
+
+				if (found_increment || block != loop.latch) {
+					return false;
+				}
+
+				// subtracting a constant rounds exactly like adding its negation
+				double step;
+				bool integer;
+				bool adds = instruction.op == RegisterOp::Add
+					&& ((instruction.b == counter && number_constant(function, instruction.c, &step, &integer))
+						|| (instruction.c == counter && number_constant(function, instruction.b, &step, &integer)));
+				bool subtracts = instruction.op == RegisterOp::Sub && instruction.b == counter && number_constant(function, instruction.c, &step, &integer);
+				if (!adds && !subtracts) {
+					return false;
+				}
+
+				if (subtracts) {
+					step = -step;
+				}
+
+				if (step == 0 || !std::isfinite(step)) {
+					return false;
+				}
+
+				counted->step = step;
+				counted->integer_step = integer;
+				counted->increment = i;
+				found_increment = true;
+			}
+		}
+
+		if (!found_increment || loop.header == 0) {
+			return false;
+		}
+
+		// the loop is only entered from the block before it, which sets the counter
+		for (uint32_t block = 0; block < blocks.size(); block++) {
+			if (block >= loop.header && block <= loop.latch) {
+				continue;
+			}
+
+			std::vector<uint32_t> successors = function.successors(block);
+			bool enters = std::find(successors.begin(), successors.end(), loop.header) != successors.end();
+			if (enters && block != loop.header - 1) {
+				return false;
+			}
+		}
+
+		const std::vector<IrInstruction>& before = blocks[loop.header - 1].instructions;
+		if (before.empty() || is_jump(before.back().op) || ends_block(before.back().op)) {
+			return false;
+		}
+
+		for (size_t i = before.size(); i-- > 0;) {
+			const IrInstruction& instruction = before[i];
+			if (is_call(instruction.op) && instruction.a <= counter) {
+				return false;
+			}
+
+			uint32_t reg;
+			if (defined_register(instruction, &reg) && reg == counter) {
+				return instruction.op == RegisterOp::Move && number_constant(function, instruction.b, &counted->start, &counted->integer_start);
+			}
+		}
+
+		return false;
+	}
+
+	bool LoopUnrolling::run(IrFunction* function)
+	{
+		bool changed = false;
+
+		for_each_loop(function, [&](const Loop& loop) {
+			CountedLoop counted;
+			if (loop.latch != loop.header + 1 || function->blocks[loop.header].instructions.size() != 1
+				|| !find_counted_loop(*function, loop, &counted)) {
+				return;
+			}
+
+			// stepping the counter here rounds exactly as the interpreter does
+			uint32_t trips = 0;
+			for (double counter = counted.start; loop_continues(counted.test, counter, counted.limit); counter += counted.step) {
+				if (++trips > MAX_UNROLLED_TRIPS) {
+					return;
+				}
+			}
+
+			std::vector<IrInstruction>& body = function->blocks[loop.latch].instructions;
+			size_t body_size = body.size() - 1;
+			if (trips * body_size > MAX_UNROLLED_INSTRUCTIONS) {
+				return;
+			}
+
+			std::vector<IrInstruction> unrolled;
+			for (uint32_t trip = 0; trip < trips; trip++) {
+				unrolled.insert(unrolled.end(), body.begin(), body.begin() + body_size);
+			}
+
+			body = std::move(unrolled);
+			function->blocks[loop.header].instructions.clear();
+			changed = true;
+		});
+
+		return changed;
+	}
+
+	// `scale * counter + offset`, over integers. `integer` is set while every
+	// value in it is an integer rather than a double that holds one.
+	struct Affine
+	{
+		double scale;
+		double offset;
+		bool integer;
+	};
+
+	// Applies an addition, subtraction or multiplication of `operand` with an
+	// integer constant.
+	static bool apply_affine(const IrFunction& function, const IrInstruction& instruction, uint32_t operand, Affine* affine)
+	{
+		double constant;
+		bool integer;
+		bool left = instruction.b == operand && number_constant(function, instruction.c, &constant, &integer);
+		bool right = !left && instruction.c == operand && number_constant(function, instruction.b, &constant, &integer);
+		if ((!left && !right) || std::trunc(constant) != constant) {
+			return false;
+		}
+
+		affine->integer = affine->integer && integer;
+
+		switch (instruction.op) {
+			case RegisterOp::Add:
+				affine->offset += constant;
+				return true;
+			case RegisterOp::Sub:
+				if (left) {
+					affine->offset -= constant;
+				}
+				else {
+					affine->scale = -affine->scale;
+					affine->offset = constant - affine->offset;
+				}
+				return true;
+			case RegisterOp::Mul:
+				affine->scale *= constant;
+				affine->offset *= constant;
+				return true;
+			default:
+				return false;
+		}
+	}
+
+	static bool adds_nonzero(const IrFunction& function, const IrInstruction& instruction)
+	{
+		double constant;
+		bool constant_operand = number_constant(function, instruction.b, &constant) || number_constant(function, instruction.c, &constant);
+		return (instruction.op == RegisterOp::Add || instruction.op == RegisterOp::Sub) && constant_operand && constant != 0;
+	}
+
+	static std::vector<bool> live_after(const IrFunction& function, std::vector<bool> live, uint32_t block, size_t index)
+	{
+		const std::vector<IrInstruction>& instructions = function.blocks[block].instructions;
+		for (size_t i = instructions.size(); i-- > index + 1;) {
+			uint32_t reg;
+			if (defined_register(instructions[i], &reg)) {
+				live[reg] = false;
+			}
+			mark_uses(function, instructions[i], live);
+		}
+
+		return live;
+	}
+
+	// Replaces the first chain of at least two instructions computing an affine
+	// function of the counter with a copy of a register kept equal to it.
+	static bool reduce_affine_chain(IrFunction* function, const Loop& loop)
+	{
+		CountedLoop counted;
+		if (has_calls(*function, loop) || !find_counted_loop(*function, loop, &counted)) {
+			return false;
+		}
+
+		// the counter stays between its start and the limit, so when those are
+		// integers every value the chain computes is exact and so is advancing it
+		bool upwards = counted.test == RegisterOp::JumpIfNotLess || counted.test == RegisterOp::JumpIfGreater;
+		if (upwards != (counted.step > 0)) {
+			return false;
+		}
+
+		// a counter that starts as an integer and steps by a double, or the other
+		// way around, changes type on its first step
+		if (counted.integer_start != counted.integer_step) {
+			return false;
+		}
+
+		double bound = std::max(std::abs(counted.start), std::abs(counted.limit)) + std::abs(counted.step);
+		bool integers = std::trunc(counted.start) == counted.start
+			&& std::trunc(counted.step) == counted.step
+			&& std::trunc(counted.limit) == counted.limit;
+		if (!integers || bound >= MAX_EXACT_INTEGER) {
+			return false;
+		}
+
+		// integer arithmetic that overflows turns into double arithmetic
+		static constexpr double MAX_INTEGER = std::min(MAX_EXACT_INTEGER, (double)Value::INTEGER_MAX);
+		if (counted.integer_start && bound >= MAX_INTEGER) {
+			return false;
+		}
+
+		auto is_exact = [&](const Affine& affine) {
+			double max = affine.integer ? MAX_INTEGER : MAX_EXACT_INTEGER;
+			return std::abs(affine.scale) * bound + std::abs(affine.offset) < max;
+		};
+
+		std::vector<std::vector<bool>> live_out = function->live_out();
+		for (uint32_t block = loop.header; block <= loop.latch; block++) {
+			std::vector<IrInstruction>& instructions = function->blocks[block].instructions;
+
+			// after the increment the counter is already a step ahead
+			size_t end = block == loop.latch ? counted.increment : instructions.size();
+			for (size_t first = 0; first < end; first++) {
+				std::vector<Affine> chain;
+				Affine affine{ 1, 0, counted.integer_start };
+				uint32_t value = counted.counter;
+
+				for (size_t last = first; last < end; last++) {
+					if (!apply_affine(*function, instructions[last], value, &affine) || !is_exact(affine)) {
+						break;
+					}
+
+					// the result it replaces must not be read anywhere else
+					if (last > first && (function->escaping[value]
+						|| (value != instructions[last].a && live_after(*function, live_out[block], block, last)[value]))) {
+						break;
+					}
+
+					chain.push_back(affine);
+					value = instructions[last].a;
+				}
+
+				// a product can be -0 where the sum that replaces it is 0, an addition
+				// of anything but 0 never is
+				while (!chain.empty() && !adds_nonzero(*function, instructions[first + chain.size() - 1])) {
+					chain.pop_back();
+				}
+
+				if (chain.size() < 2 || chain.back().scale == 0) {
+					continue;
+				}
+
+				affine = chain.back();
+				size_t last = first + chain.size();
+				double start = affine.scale * counted.start + affine.offset;
+				if (start == 0) {
+					start = 0;
+				}
+
+				uint32_t reduced = function->add_register();
+				IrInstruction& result = instructions[last - 1];
+				result = IrInstruction{ RegisterOp::Move, result.a, reduced, 0, result.line };
+				instructions.erase(instructions.begin() + first, instructions.begin() + (last - 1));
+
+				std::vector<IrInstruction>& latch = function->blocks[loop.latch].instructions;
+				size_t increment = counted.increment - (block == loop.latch ? last - 1 - first : 0);
+				latch.insert(latch.begin() + increment + 1, IrInstruction{
+					RegisterOp::Add, reduced, reduced, add_number(function, affine.scale * counted.step, affine.integer), latch[increment].line
+				});
+
+				std::vector<IrInstruction>& before = function->blocks[loop.header - 1].instructions;
+				before.push_back(IrInstruction{
+					RegisterOp::Move, reduced, add_number(function, start, affine.integer), 0, before.back().line
+				});
+
+				return true;
+			}
+		}
+
+		return false;
+	}
+
+	bool StrengthReduction::run(IrFunction* function)
+	{
+		bool changed = false;
+
+		for_each_loop(function, [&](const Loop& loop) {
+			while (reduce_affine_chain(function, loop)) {
+				changed = true;
+			}
+		});
+
+		return changed;
+	}
+
+	// Blocks of the loop on every path from its header to its latch.
+	static std::vector<bool> dominates_latch(const IrFunction& function, const Loop& loop)
+	{
+		uint32_t size = loop.latch - loop.header + 1;
+		std::vector<std::vector<uint32_t>> successors(size);
+		for (uint32_t i = 0; i < size; i++) {
+			successors[i] = function.successors(loop.header + i);
+		}
+
+		// dominators[i][j]: block j of the loop is on every path from the header to block i
+		std::vector<std::vector<bool>> dominators(size, std::vector<bool>(size, true));
+		dominators[0].assign(size, false);
+		dominators[0][0] = true;
+
+		bool changed = true;
+		while (changed) {
+			changed = false;
+
+			for (uint32_t i = 1; i < size; i++) {
+				std::vector<bool> dominated(size, true);
+				for (uint32_t j = 0; j < size; j++) {
+					if (std::find(successors[j].begin(), successors[j].end(), loop.header + i) == successors[j].end()) {
+						continue;
+					}
+
+					for (uint32_t k = 0; k < size; k++) {
+						dominated[k] = dominated[k] && dominators[j][k];
+					}
+				}
+				dominated[i] = true;
+
+				if (dominated != dominators[i]) {
+					dominators[i].swap(dominated);
+					changed = true;
+				}
+			}
+		}
+
+		return dominators[size - 1];
+	}
+
+	static bool hoist_invariants(IrFunction* function, const Loop& loop)
+	{
+		size_t size = 0;
+		for (uint32_t block = loop.header; block <= loop.latch; block++) {
+			size += function->blocks[block].instructions.size();
+		}
+
+		if (size > MAX_PEELED_INSTRUCTIONS || has_calls(*function, loop)) {
+			return false;
+		}
+
+		std::vector<uint32_t> definitions(function->register_count, 0);
+		std::vector<uint32_t> written_globals;
+		bool writes_upvalues = false;
+		for (uint32_t block = loop.header; block <= loop.latch; block++) {
+			for (const IrInstruction& instruction : function->blocks[block].instructions) {
+				uint32_t reg;
+				if (defined_register(instruction, &reg)) {
+					definitions[reg]++;
+				}
+
+				if (instruction.op == RegisterOp::SetGlobal || instruction.op == RegisterOp::DefineGlobal) {
+					written_globals.push_back(instruction.b);
+				}
+				else if (instruction.op == RegisterOp::SetUpvalue) {
+					writes_upvalues = true;
+				}
+			}
+		}
+
+		// registers the loop only sets to a value computed in the peeled iteration,
+		// and the ones that hold such a value from there to the end of the block
+		std::vector<bool> hoisted(function->register_count, false);
+		std::vector<bool> holds_invariant;
+		auto is_invariant = [&](uint32_t operand) {
+			return !is_register(operand)
+				|| (!function->escaping[operand] && (definitions[operand] == 0 || hoisted[operand] || holds_invariant[operand]));
+		};
+
+		auto can_hoist = [&](IrInstruction instruction) {
+			bool reads_registers = reads_registers_of(instruction.op);
+			bool reads_global = instruction.op == RegisterOp::GetGlobal;
+			bool reads_upvalue = instruction.op == RegisterOp::GetUpvalue;
+			if ((!reads_registers && !reads_global && !reads_upvalue) || function->escaping[instruction.a]) {
+				return false;
+			}
+
+			if (reads_global) {
+				return std::find(written_globals.begin(), written_globals.end(), instruction.b) == written_globals.end();
+			}
+			if (reads_upvalue) {
+				return !writes_upvalues;
+			}
+
+			uint32_t* operands[2];
+			uint32_t count = read_operands(instruction, operands);
+			for (uint32_t i = 0; i < count; i++) {
+				if (!is_invariant(*operands[i])) {
+					return false;
+				}
+			}
+
+			return true;
+		};
+
+		// the first iteration runs from a copy of the loop, in its original order, so
+		// anything that fails still fails where it did; it keeps every invariant it
+		// computes in a new register, and the loop copies them from there
+		std::vector<IrBlock> peeled(function->blocks.begin() + loop.header, function->blocks.begin() + loop.latch + 1);
+		std::vector<bool> runs_every_iteration = dominates_latch(*function, loop);
+		uint32_t register_count = function->register_count;
+
+		for (uint32_t block = loop.header; block <= loop.latch; block++) {
+			if (!runs_every_iteration[block - loop.header]) {
+				continue;
+			}
+
+			std::vector<IrInstruction>& instructions = function->blocks[block].instructions;
+			std::vector<IrInstruction>& copy = peeled[block - loop.header].instructions;
+			size_t inserted = 0;
+			holds_invariant.assign(register_count, false);
+
+			for (size_t i = 0; i < instructions.size(); i++) {
+				IrInstruction& instruction = instructions[i];
+				if (!can_hoist(instruction)) {
+					uint32_t reg;
+					if (defined_register(instruction, &reg)) {
+						holds_invariant[reg] = false;
+					}
+					continue;
+				}
+
+				uint32_t value = function->add_register();
+				holds_invariant[instruction.a] = true;
+				if (definitions[instruction.a] == 1) {
+					hoisted[instruction.a] = true;
+				}
+
+				copy.insert(copy.begin() + i + ++inserted, IrInstruction{ RegisterOp::Move, value, instruction.a, 0, instruction.line });
+				instruction = IrInstruction{ RegisterOp::Move, instruction.a, value, 0, instruction.line };
+			}
+		}
+
+		if (function->register_count == register_count) {
+			return false;
+		}
+
+		// the loop is entered through the copy, whose jump back enters the loop itself
+		uint32_t shift = loop.latch - loop.header + 1;
+		for (uint32_t block = 0; block < function->blocks.size(); block++) {
+			bool inside = block >= loop.header && block <= loop.latch;
+			for (IrInstruction& instruction : function->blocks[block].instructions) {
+				if (!is_jump(instruction.op)) {
+					continue;
+				}
+
+				uint32_t& target = jump_target(instruction);
+				if (target > loop.header || (target == loop.header && inside)) {
+					target += shift;
+				}
+			}
+		}
+
+		for (IrBlock& block : peeled) {
+			for (IrInstruction& instruction : block.instructions) {
+				if (!is_jump(instruction.op)) {
+					continue;
+				}
+
+				uint32_t& target = jump_target(instruction);
+				if (target == loop.header || target > loop.latch) {
+					target += shift;
+				}
+			}
+		}
+
+		function->blocks.insert(function->blocks.begin() + loop.header, peeled.begin(), peeled.end());
+		return true;
+	}
+
+	bool LoopInvariantCodeMotion::run(IrFunction* function)
+	{
+		bool changed = false;
+
+		for_each_loop(function, [&](const Loop& loop) {
+			if (hoist_invariants(function, loop)) {
+				changed = true;
+			}
+		});
+
+		return changed;
+	}
+
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include "PassManager.h"
+
+#include <functional>
+#include <vector>
+
+namespace dynamix {
+
+	// A loop as the front end lays out `while` and `for`: the header ends in the
+	// test that leaves to the block after the latch, the body follows and the
+	// latch jumps back to the header. Nothing outside jumps past the header.
+	struct Loop
+	{
+		uint32_t header;
+		uint32_t latch;
+	};
+
+	// A loop whose header compares a counter with a constant limit, and whose only
+	// change to the counter is adding a constant step in the latch. The counter
+	// is set to a constant right before the loop.
+	struct CountedLoop
+	{
+		uint32_t counter;
+		double start;
+		double step;
+		double limit;
+		bool integer_start;
+		bool integer_step;
+		RegisterOp test;
+		size_t increment;
+	};
+
+	// Loops of a function, innermost first.
+	std::vector<Loop> find_loops(const IrFunction& function);
+
+	// Visits every loop once, innermost first. `visit` may rewrite the loop and
+	// insert blocks in front of its header.
+	void for_each_loop(IrFunction* function, const std::function<void(const Loop&)>& visit);
+
+	bool find_counted_loop(const IrFunction& function, const Loop& loop, CountedLoop* counted);
+
+	// Replaces a counted loop that runs a small, known number of times and whose
+	// body is a single block with that many copies of the body.
+	class LoopUnrolling : public Pass
+	{
+	public:
+		const char* name() const override { return "loop unrolling"; }
+		bool run(IrFunction* function) override;
+	};
+
+	// Replaces an affine function of the counter of a counted loop, such as
+	// `i * 4 + 1`, with a register that is advanced along with the counter.
+	class StrengthReduction : public Pass
+	{
+	public:
+		const char* name() const override { return "strength reduction"; }
+		bool run(IrFunction* function) override;
+	};
+
+	// Computes arithmetic on values a loop does not change, and reads of globals and
+	// upvalues it does not write, once. The first iteration is peeled off in front
+	// of the loop and keeps the invariants it computes on the way to the latch, so
+	// errors are still reported where they happen; the loop itself copies them.
+	class LoopInvariantCodeMotion : public Pass
+	{
+	public:
+		const char* name() const override { return "loop invariant code motion"; }
+		bool run(IrFunction* function) override;
+	};
+
+}
@@ -1,8 +1,12 @@
 #pragma once
 
 #include "ByteBlock.h"
+#include "DecodedBlock.h"
+#include "RegisterBlock.h"
 
 #include <string>
+#include <string_view>
+#include <vector>
 
 namespace dynamix {
 
@@ -10,23 +14,83 @@ namespace dynamix {
 	{
 		Function,
 		String,
+		Closure,
+		Upvalue,
 	};
 
+	// Common header of every heap object. The heap threads all live objects
+	// through `next` and the collector uses `is_marked` during tracing.
 	struct Obj
 	{
 		ObjType type;
+		bool is_marked = false;
+		Obj* next = nullptr;
 	};
 
-	struct ObjFunction
+	// Where a closure finds one of its captured variables when it is created: a
+	// local slot of the enclosing frame, or an upvalue of the enclosing closure.
+	struct UpvalueCapture
+	{
+		bool is_local;
+		uint32_t index;
+	};
+
+	struct ObjFunction : Obj
 	{
 		uint32_t arity;
 		ByteBlock block;
+		DecodedBlock decoded;    // only filled in when compiling for the stack backend
+		RegisterBlock registers; // only filled in when compiling for the register backend
 		std::string name;
+		std::vector<UpvalueCapture> captures;
+	};
+
+	// A captured variable. While open it points at the variable's stack slot,
+	// once the slot goes out of scope the value moves into `closed`.
+	struct ObjUpvalue : Obj
+	{
+		Value* location;
+		Value closed;
+		ObjUpvalue* next_open = nullptr;
+	};
+
+	// Only functions that capture variables are wrapped in a closure at runtime.
+	struct ObjClosure : Obj
+	{
+		ObjFunction* function;
+		std::vector<ObjUpvalue*> upvalues;
+	};
+
+	// Strings are interned by the heap, so two flat strings with the same contents
+	// are always the same object and can be compared by pointer. A flat string's
+	// characters are allocated right after it and are not null terminated. Joining
+	// long strings makes a rope instead: it only points at its two halves, and its
+	// text is put together when something reads it.
+	struct ObjString : Obj
+	{
+		uint32_t hash = 0;
+		size_t length = 0;
+		ObjString* left = nullptr;
+		ObjString* right = nullptr;
+
+		bool is_rope() const { return left != nullptr; }
+		// a rope whose text has been read keeps the flat string in `left` and drops its halves
+		bool is_flattened() const { return is_rope() && right == nullptr; }
+		// the interned string with the same text, null for a rope that was never read
+		const ObjString* flat() const { return is_flattened() ? left : is_rope() ? nullptr : this; }
+
+		// only for flat strings
+		const char* chars() const { return (const char*)(this + 1); }
+		std::string_view view() const { return std::string_view(chars(), length); }
+
+		std::string text() const;
 	};
 
-	struct ObjString
+	struct ObjStringHash
 	{
-		std::string obj;
+		size_t operator()(const ObjString* string) const {
+			return string->hash;
+		}
 	};
 
 }
@@ -0,0 +1,319 @@
+#include "PassManager.h"
+#include "LoopPasses.h"
+
+#include "dynamix.h"
+
+#include <unordered_map>
+#include <algorithm>
+
+namespace dynamix {
+
+	PassManager PassManager::for_level(uint32_t level)
+	{
+		PassManager manager;
+		if (level >= 2) {
+			manager.add(std::make_unique<CopyPropagation>());
+			manager.add(std::make_unique<CommonSubexpressionElimination>());
+		}
+
+		if (level >= 1) {
+			manager.add(std::make_unique<CopyPropagation>());
+			manager.add(std::make_unique<DeadStoreElimination>());
+			manager.add(std::make_unique<ResultCoalescing>());
+			manager.add(std::make_unique<CompareBranchFusion>());
+		}
+
+		if (level >= 2) {
+			manager.add(std::make_unique<LoopUnrolling>());
+			manager.add(std::make_unique<StrengthReduction>());
+			manager.add(std::make_unique<LoopInvariantCodeMotion>());
+			manager.add(std::make_unique<CommonSubexpressionElimination>());
+			manager.add(std::make_unique<CopyPropagation>());
+			manager.add(std::make_unique<DeadStoreElimination>());
+			manager.add(std::make_unique<ResultCoalescing>());
+		}
+
+		return manager;
+	}
+
+	void PassManager::add(std::unique_ptr<Pass> pass)
+	{
+		m_Passes.push_back(std::move(pass));
+	}
+
+	void PassManager::run(IrFunction* function) const
+	{
+		for (const std::unique_ptr<Pass>& pass : m_Passes) {
+			bool changed = pass->run(function);
+#if DEBUG_LOG_PASSES
+			printf("-- pass: %s%s\n", pass->name(), changed ? "" : " (no change)");
+#else
+			(void)changed;
+#endif
+		}
+	}
+
+	// a call runs with its window starting at the callee, so it may overwrite every
+	// register from there up, and any register a closure captured
+	static bool clobbered_by_call(const IrFunction* function, const IrInstruction& call, uint32_t operand)
+	{
+		return is_register(operand) && (operand >= call.a || function->escaping[operand]);
+	}
+
+	bool CopyPropagation::run(IrFunction* function)
+	{
+		bool changed = false;
+
+		for (IrBlock& block : function->blocks) {
+			// register -> the register or constant it currently holds a copy of
+			std::unordered_map<uint32_t, uint32_t> copies;
+			auto kill = [&](uint32_t reg) {
+				copies.erase(reg);
+				std::erase_if(copies, [reg](const auto& copy) { return copy.second == reg; });
+			};
+
+			std::vector<IrInstruction>& instructions = block.instructions;
+			for (size_t i = 0; i < instructions.size();) {
+				IrInstruction& instruction = instructions[i];
+
+				uint32_t* operands[2];
+				uint32_t count = read_operands(instruction, operands);
+				for (uint32_t j = 0; j < count; j++) {
+					auto copy = is_register(*operands[j]) ? copies.find(*operands[j]) : copies.end();
+					if (copy != copies.end()) {
+						*operands[j] = copy->second;
+						changed = true;
+					}
+				}
+
+				if (instruction.op == RegisterOp::Call || instruction.op == RegisterOp::TailCall) {
+					std::erase_if(copies, [&](const auto& copy) {
+						return clobbered_by_call(function, instruction, copy.first) || clobbered_by_call(function, instruction, copy.second);
+					});
+				}
+
+				uint32_t reg;
+				if (defined_register(instruction, &reg)) {
+					if (instruction.op == RegisterOp::Move && instruction.b == reg) {
+						instructions.erase(instructions.begin() + i);
+						changed = true;
+						continue;
+					}
+
+					kill(reg);
+					if (instruction.op == RegisterOp::Move) {
+						copies[reg] = instruction.b;
+					}
+				}
+
+				i++;
+			}
+		}
+
+		return changed;
+	}
+
+	bool DeadStoreElimination::run(IrFunction* function)
+	{
+		bool changed = false;
+		while (remove_dead_stores(function)) {
+			changed = true;
+		}
+
+		return changed;
+	}
+
+	bool DeadStoreElimination::remove_dead_stores(IrFunction* function)
+	{
+		bool changed = false;
+		std::vector<std::vector<bool>> live_out = function->live_out();
+
+		for (uint32_t index = 0; index < function->blocks.size(); index++) {
+			std::vector<IrInstruction>& instructions = function->blocks[index].instructions;
+			std::vector<bool>& live = live_out[index];
+
+			for (size_t i = instructions.size(); i-- > 0;) {
+				const IrInstruction& instruction = instructions[i];
+
+				bool removable = is_side_effect_free(instruction.op);
+
+				uint32_t reg;
+				bool defines = defined_register(instruction, &reg);
+				if (removable && !live[reg] && !function->escaping[reg]) {
+					instructions.erase(instructions.begin() + i);
+					changed = true;
+					continue;
+				}
+
+				if (defines) {
+					live[reg] = false;
+				}
+				mark_uses(*function, instruction, live);
+			}
+		}
+
+		return changed;
+	}
+
+	bool CommonSubexpressionElimination::run(IrFunction* function)
+	{
+		bool changed = false;
+
+		struct Expression
+		{
+			RegisterOp op;
+			uint32_t b;
+			uint32_t c;
+			uint32_t reg;
+		};
+
+		for (IrBlock& block : function->blocks) {
+			std::vector<Expression> available;
+
+			for (IrInstruction& instruction : block.instructions) {
+				// operands of globals and upvalues are indices, not registers
+				bool reads_registers = reads_registers_of(instruction.op);
+				bool is_pure = reads_registers || instruction.op == RegisterOp::GetGlobal || instruction.op == RegisterOp::GetUpvalue;
+
+				auto uses = [&](const Expression& expression, uint32_t reg) {
+					return expression.reg == reg || (reads_registers_of(expression.op) && (expression.b == reg || expression.c == reg));
+				};
+
+				if (is_pure) {
+					auto found = std::find_if(available.begin(), available.end(), [&](const Expression& expression) {
+						return expression.op == instruction.op && expression.b == instruction.b && expression.c == instruction.c;
+					});
+
+					if (found != available.end()) {
+						instruction = IrInstruction{ RegisterOp::Move, instruction.a, found->reg, 0, instruction.line };
+						changed = true;
+
+						// recomputed into the register that already holds it
+						if (instruction.a == instruction.b) {
+							continue;
+						}
+					}
+				}
+
+				switch (instruction.op) {
+					case RegisterOp::Call:
+					case RegisterOp::TailCall:
+						std::erase_if(available, [&](const Expression& expression) {
+							return expression.op == RegisterOp::GetGlobal || expression.op == RegisterOp::GetUpvalue
+								|| clobbered_by_call(function, instruction, expression.reg)
+								|| (reads_registers_of(expression.op) && (clobbered_by_call(function, instruction, expression.b) || clobbered_by_call(function, instruction, expression.c)));
+						});
+						break;
+					case RegisterOp::DefineGlobal:
+					case RegisterOp::SetGlobal:
+						std::erase_if(available, [&](const Expression& expression) {
+							return expression.op == RegisterOp::GetGlobal && expression.b == instruction.b;
+						});
+						break;
+					case RegisterOp::SetUpvalue:
+						std::erase_if(available, [&](const Expression& expression) {
+							return expression.op == RegisterOp::GetUpvalue;
+						});
+						break;
+					default:
+						break;
+				}
+
+				uint32_t reg;
+				if (defined_register(instruction, &reg)) {
+					std::erase_if(available, [&](const Expression& expression) { return uses(expression, reg); });
+
+					bool reads_itself = reads_registers && (instruction.b == reg || instruction.c == reg);
+					if (is_pure && instruction.op != RegisterOp::Move && !reads_itself) {
+						available.push_back(Expression{ instruction.op, instruction.b, instruction.c, reg });
+					}
+				}
+			}
+		}
+
+		return changed;
+	}
+
+	bool ResultCoalescing::run(IrFunction* function)
+	{
+		bool changed = false;
+		std::vector<std::vector<bool>> live_out = function->live_out();
+
+		for (uint32_t index = 0; index < function->blocks.size(); index++) {
+			std::vector<IrInstruction>& instructions = function->blocks[index].instructions;
+			std::vector<bool>& live = live_out[index];
+
+			for (size_t i = instructions.size(); i-- > 0;) {
+				IrInstruction& instruction = instructions[i];
+
+				// `live` holds the registers read after the move
+				uint32_t from = instruction.b;
+				bool coalesce = i > 0
+					&& instruction.op == RegisterOp::Move
+					&& is_register(from)
+					&& !live[from]
+					&& !function->escaping[from];
+
+				uint32_t reg;
+				IrInstruction& previous = instructions[i > 0 ? i - 1 : 0];
+				coalesce = coalesce
+					&& previous.op != RegisterOp::Call
+					&& previous.op != RegisterOp::Closure
+					&& defined_register(previous, &reg)
+					&& reg == from;
+
+				if (coalesce) {
+					previous.a = instruction.a;
+					instructions.erase(instructions.begin() + i);
+					changed = true;
+					continue;
+				}
+
+				if (defined_register(instruction, &reg)) {
+					live[reg] = false;
+				}
+				mark_uses(*function, instruction, live);
+			}
+		}
+
+		return changed;
+	}
+
+	bool CompareBranchFusion::run(IrFunction* function)
+	{
+		bool changed = false;
+		std::vector<std::vector<bool>> live_out = function->live_out();
+
+		for (uint32_t index = 0; index < function->blocks.size(); index++) {
+			std::vector<IrInstruction>& instructions = function->blocks[index].instructions;
+			if (instructions.size() < 2) {
+				continue;
+			}
+
+			IrInstruction& jump = instructions.back();
+			IrInstruction& compare = instructions[instructions.size() - 2];
+			if (jump.op != RegisterOp::JumpIfFalse || !is_register(jump.a) || compare.a != jump.a
+				|| live_out[index][jump.a] || function->escaping[jump.a]) {
+				continue;
+			}
+
+			RegisterOp fused;
+			switch (compare.op) {
+				case RegisterOp::Less:         fused = RegisterOp::JumpIfNotLess;    break;
+				case RegisterOp::Greater:      fused = RegisterOp::JumpIfNotGreater; break;
+				case RegisterOp::GreaterEqual: fused = RegisterOp::JumpIfLess;       break;
+				case RegisterOp::LessEqual:    fused = RegisterOp::JumpIfGreater;    break;
+				case RegisterOp::Equal:        fused = RegisterOp::JumpIfNotEqual;   break;
+				case RegisterOp::NotEqual:     fused = RegisterOp::JumpIfEqual;      break;
+				default:                       continue;
+			}
+
+			compare = IrInstruction{ fused, compare.b, compare.c, jump.b, compare.line };
+			instructions.pop_back();
+			changed = true;
+		}
+
+		return changed;
+	}
+
+}
@@ -0,0 +1,85 @@
+#pragma once
+
+#include "Ir.h"
+
+#include <memory>
+#include <vector>
+
+namespace dynamix {
+
+	// A transformation of the IR of one function. `run` returns whether it changed anything.
+	class Pass
+	{
+	public:
+		virtual ~Pass() = default;
+
+		virtual const char* name() const = 0;
+		virtual bool run(IrFunction* function) = 0;
+	};
+
+	// Runs a sequence of passes over every function before it is lowered to register code.
+	class PassManager
+	{
+	public:
+		// -O0 lowers the lifted code as it is, -O1 removes the copies the stack
+		// bytecode implies and -O2 also reuses repeated computations and moves
+		// work out of loops.
+		static PassManager for_level(uint32_t level);
+
+		void add(std::unique_ptr<Pass> pass);
+		void run(IrFunction* function) const;
+
+	private:
+		std::vector<std::unique_ptr<Pass>> m_Passes;
+	};
+
+	// Replaces reads of a register that holds a copy of another register or of a
+	// constant with the original, within a basic block.
+	class CopyPropagation : public Pass
+	{
+	public:
+		const char* name() const override { return "copy propagation"; }
+		bool run(IrFunction* function) override;
+	};
+
+	// Removes side effect free instructions whose result is never read, until the
+	// ones they read are not read either.
+	class DeadStoreElimination : public Pass
+	{
+	public:
+		const char* name() const override { return "dead store elimination"; }
+		bool run(IrFunction* function) override;
+
+	private:
+		static bool remove_dead_stores(IrFunction* function);
+	};
+
+	// Replaces a computation that is already available in a register, within a
+	// basic block, with a copy of that register.
+	class CommonSubexpressionElimination : public Pass
+	{
+	public:
+		const char* name() const override { return "common subexpression elimination"; }
+		bool run(IrFunction* function) override;
+	};
+
+	// Writes a result straight into the register it is moved to next, when the
+	// register it was computed in is not read again: `ADD r5, r1, r2; MOVE r1, r5`
+	// becomes `ADD r1, r1, r2`.
+	class ResultCoalescing : public Pass
+	{
+	public:
+		const char* name() const override { return "result coalescing"; }
+		bool run(IrFunction* function) override;
+	};
+
+	// Merges a comparison that only feeds the conditional jump after it into a
+	// compare-and-branch instruction.
+	class CompareBranchFusion : public Pass
+	{
+	public:
+		const char* name() const override { return "compare branch fusion"; }
+		bool run(IrFunction* function) override;
+	};
+
+}
@@ -0,0 +1,209 @@
+#include "Peephole.h"
+
+#include <vector>
+#include <utility>
+
+namespace dynamix {
+
+	void Peephole::optimize(ByteBlock* block)
+	{
+		const int32_t size = (int32_t)block->bytes.size();
+
+		// a pair can only be fused if nothing jumps between its two instructions
+		std::vector<bool> is_target(size + 1, false);
+		for (int32_t offset = 0; offset < size;) {
+			OpCode instruction = (OpCode)block->bytes[offset];
+			if (is_jump(instruction)) {
+				is_target[jump_target(block, offset)] = true;
+			}
+
+			offset += instruction_length(instruction);
+		}
+
+		auto fusable = [&](int32_t next, OpCode expected) {
+			return next < size && (OpCode)block->bytes[next] == expected && !is_target[next];
+		};
+		auto pushes_integer = [&](int32_t offset, int64_t integer) {
+			const Value& value = block->constants[block->bytes[offset + 1]];
+			return value.is(ValueType::Integer) && value.as_integer() == integer;
+		};
+
+		std::vector<uint8_t> bytes;
+		std::vector<uint32_t> lines;
+		std::vector<int32_t> new_offsets(size + 1, -1);
+		std::vector<std::pair<int32_t, int32_t>> jumps;
+		bytes.reserve(size);
+		lines.reserve(size);
+
+		for (int32_t offset = 0; offset < size;) {
+			OpCode instruction = (OpCode)block->bytes[offset];
+			int32_t length = instruction_length(instruction);
+			uint32_t line = block->lines[offset];
+			new_offsets[offset] = (int32_t)bytes.size();
+
+			OpCode fused = instruction;
+			int32_t consumed = length;
+			// bytes of the first instruction kept, its opcode replaced with `fused`
+			int32_t copied = length;
+
+			switch (instruction) {
+				case OpCode::PushConstant:
+					if (pushes_integer(offset, 0) || pushes_integer(offset, 1)) {
+						fused = pushes_integer(offset, 0) ? OpCode::PushZero : OpCode::PushOne;
+						copied = 1;
+					}
+					break;
+				case OpCode::GetLocal: {
+					// `i = i + 1` as a statement, on a local known to be a number
+					uint8_t slot = block->bytes[offset + 1];
+					bool increments = fusable(offset + 2, OpCode::PushConstant) && pushes_integer(offset + 2, 1)
+						&& fusable(offset + 4, OpCode::AddUnchecked)
+						&& fusable(offset + 5, OpCode::SetLocal) && block->bytes[offset + 6] == slot
+						&& fusable(offset + 7, OpCode::Pop);
+					if (increments) {
+						fused = OpCode::IncLocal;
+						consumed = 8;
+					}
+					else if (slot < 4) {
+						fused = (OpCode)((uint8_t)OpCode::GetLocal0 + slot);
+						copied = 1;
+					}
+				} break;
+				case OpCode::Equal:
+					if (fusable(offset + 1, OpCode::Not)) {
+						fused = OpCode::NotEqual;
+						consumed = 2;
+					}
+					break;
+				case OpCode::Less:
+					if (fusable(offset + 1, OpCode::Not)) {
+						fused = OpCode::GreaterEqual;
+						consumed = 2;
+					}
+					break;
+				case OpCode::Greater:
+					if (fusable(offset + 1, OpCode::Not)) {
+						fused = OpCode::LessEqual;
+						consumed = 2;
+					}
+					break;
+				case OpCode::LessUnchecked:
+					if (fusable(offset + 1, OpCode::Not)) {
+						fused = OpCode::GreaterEqualUnchecked;
+						consumed = 2;
+					}
+					break;
+				case OpCode::GreaterUnchecked:
+					if (fusable(offset + 1, OpCode::Not)) {
+						fused = OpCode::LessEqualUnchecked;
+						consumed = 2;
+					}
+					break;
+				case OpCode::SetLocal:
+					if (fusable(offset + 2, OpCode::Pop)) {
+						fused = OpCode::StoreLocalPop;
+						consumed = 3;
+					}
+					else if (block->bytes[offset + 1] < 4) {
+						fused = (OpCode)((uint8_t)OpCode::SetLocal0 + block->bytes[offset + 1]);
+						copied = 1;
+					}
+					break;
+				default:
+					break;
+			}
+
+			if (is_jump(fused)) {
+				jumps.push_back({ (int32_t)bytes.size(), jump_target(block, offset) });
+			}
+
+			bytes.push_back((uint8_t)fused);
+			lines.push_back(line);
+			for (int32_t i = 1; i < copied; i++) {
+				bytes.push_back(block->bytes[offset + i]);
+				lines.push_back(block->lines[offset + i]);
+			}
+
+			offset += consumed;
+		}
+
+		new_offsets[size] = (int32_t)bytes.size();
+
+		block->bytes.swap(bytes);
+		block->lines.swap(lines);
+
+		// jumps were copied with their old relative offsets, retarget them to the new layout
+		for (auto [offset, old_target] : jumps) {
+			patch_jump(block, offset, new_offsets[old_target]);
+		}
+	}
+
+	bool Peephole::is_jump(OpCode instruction)
+	{
+		switch (instruction) {
+			case OpCode::Jmp:
+			case OpCode::JmpLong:
+			case OpCode::Jz:
+			case OpCode::JzLong:
+			case OpCode::Loop:
+			case OpCode::LoopLong:
+			case OpCode::JumpIfFalsePop:
+			case OpCode::JumpIfFalsePopLong:
+			case OpCode::JumpIfTruePop:
+			case OpCode::JumpIfTruePopLong:
+			case OpCode::JumpIfNotLess:
+			case OpCode::JumpIfNotGreater:
+			case OpCode::JumpIfLess:
+			case OpCode::JumpIfGreater:
+				return true;
+			default:
+				return false;
+		}
+	}
+
+	int32_t Peephole::jump_width(OpCode instruction)
+	{
+		switch (instruction) {
+			case OpCode::JmpLong:
+			case OpCode::JzLong:
+			case OpCode::LoopLong:
+			case OpCode::JumpIfFalsePopLong:
+			case OpCode::JumpIfTruePopLong:
+				return 3;
+			default:
+				return 2;
+		}
+	}
+
+	int32_t Peephole::jump_target(const ByteBlock* block, int32_t offset)
+	{
+		// the jump distance is always the last operand, relative to the next instruction
+		OpCode instruction = (OpCode)block->bytes[offset];
+		int32_t next = offset + instruction_length(instruction);
+
+		int32_t jump = 0;
+		for (int32_t i = next - jump_width(instruction); i < next; i++) {
+			jump = (jump << 8) | block->bytes[i];
+		}
+
+		if (instruction == OpCode::Loop || instruction == OpCode::LoopLong) {
+			return next - jump;
+		}
+
+		return next + jump;
+	}
+
+	void Peephole::patch_jump(ByteBlock* block, int32_t offset, int32_t target)
+	{
+		OpCode instruction = (OpCode)block->bytes[offset];
+		int32_t next = offset + instruction_length(instruction);
+		bool is_loop = instruction == OpCode::Loop || instruction == OpCode::LoopLong;
+		int32_t jump = is_loop ? next - target : target - next;
+
+		for (int32_t i = next - 1; i >= next - jump_width(instruction); i--) {
+			block->bytes[i] = jump & 0xff;
+			jump >>= 8;
+		}
+	}
+
+}
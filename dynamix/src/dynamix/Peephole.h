@@ -0,0 +1,23 @@
+#pragma once
+
+#include "ByteBlock.h"
+
+namespace dynamix {
+
+	// Post-compilation pass that rewrites short instruction sequences emitted by the
+	// single-pass compiler into fused opcodes, e.g. `Equal, Not` into `NotEqual`.
+	// Jump offsets and the line table are kept in sync with the rewritten code.
+	class Peephole
+	{
+	public:
+		static void optimize(ByteBlock* block);
+
+		static bool is_jump(OpCode instruction);
+		static int32_t jump_target(const ByteBlock* block, int32_t offset);
+
+	private:
+		static int32_t jump_width(OpCode instruction);
+		static void patch_jump(ByteBlock* block, int32_t offset, int32_t target);
+	};
+
+}
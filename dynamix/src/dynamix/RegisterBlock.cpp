@@ -0,0 +1,12 @@
+#include "RegisterBlock.h"
+
+namespace dynamix {
+
+	int32_t RegisterBlock::write(RegisterInstruction instruction, uint32_t line)
+	{
+		code.push_back(instruction);
+		lines.push_back(line);
+		return (int32_t)(code.size() - 1);
+	}
+
+}
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+
+// An operand with this bit set indexes the constant table instead of the frame's slot window.
+#define REGISTER_CONSTANT 0x80000000u
+
+namespace dynamix {
+
+	// Instructions of the register backend. Operands named `rk` below are either a
+	// register or a constant, see REGISTER_CONSTANT; jump targets are instruction indices.
+	enum class RegisterOp : uint8_t
+	{
+		Move,             // a = rk b
+		LoadNull,         // a = null
+		LoadTrue,         // a = true
+		LoadFalse,        // a = false
+		Equal,            // a = rk b == rk c
+		Greater,
+		Less,
+		NotEqual,
+		GreaterEqual,
+		LessEqual,
+		Add,              // a = rk b + rk c
+		Sub,
+		Div,
+		Mul,
+		Mod,
+		BitAnd,
+		BitOr,
+		BitXor,
+		ShiftLeft,
+		ShiftRight,
+		Negate,           // a = -rk b
+		Not,              // a = !rk b
+		Jmp,              // goto a
+		JumpIfFalse,      // if !rk a goto b
+		JumpIfTrue,       // if rk a goto b
+		JumpIfNotLess,    // if !(rk a < rk b) goto c
+		JumpIfNotGreater,
+		JumpIfLess,
+		JumpIfGreater,
+		JumpIfEqual,
+		JumpIfNotEqual,
+		DefineGlobal,     // global b = rk a
+		GetGlobal,        // a = global b
+		SetGlobal,        // global b = rk a
+		GetUpvalue,       // a = upvalue b
+		SetUpvalue,       // upvalue b = rk a
+		CloseUpvalues,    // close every upvalue from register a up
+		Closure,          // a = closure over constant b
+		Print,            // print rk a
+		Call,             // a = a(a + 1, ..., a + b)
+		TailCall,
+		Return,           // return rk a
+	};
+
+	// A three-address instruction over the slot window of a call frame.
+	struct RegisterInstruction
+	{
+		RegisterOp op;
+		uint32_t a = 0;
+		uint32_t b = 0;
+		uint32_t c = 0;
+	};
+
+	// Register code of a function. It shares the constant table of the function's
+	// ByteBlock, `register_count` is the size of the slot window it needs.
+	struct RegisterBlock
+	{
+	public:
+		std::vector<RegisterInstruction> code;
+		std::vector<uint32_t> lines;
+		uint32_t register_count = 0;
+
+		int32_t write(RegisterInstruction instruction, uint32_t line);
+	};
+
+}
@@ -0,0 +1,114 @@
+#include "SlabAllocator.h"
+
+#include <algorithm>
+#include <new>
+
+namespace dynamix {
+
+	SlabAllocator::~SlabAllocator()
+	{
+		for (void* slab : m_Slabs) {
+			::operator delete(slab);
+		}
+
+		while (m_LargeBlocks) {
+			LargeBlock* next = m_LargeBlocks->next;
+			::operator delete(m_LargeBlocks);
+			m_LargeBlocks = next;
+		}
+	}
+
+	void* SlabAllocator::allocate(size_t size)
+	{
+		m_Stats.allocations++;
+
+		if (size > MAX_SMALL_SIZE) {
+			m_Stats.large_allocations++;
+			m_Stats.bytes_in_use += size;
+			m_Stats.peak_bytes_in_use = std::max(m_Stats.peak_bytes_in_use, m_Stats.bytes_in_use);
+
+			LargeBlock* block = (LargeBlock*)::operator new(LARGE_HEADER_SIZE + size);
+			block->previous = nullptr;
+			block->next = m_LargeBlocks;
+			if (m_LargeBlocks) {
+				m_LargeBlocks->previous = block;
+			}
+			m_LargeBlocks = block;
+			return (char*)block + LARGE_HEADER_SIZE;
+		}
+
+		size_t index = size_class(size);
+		if (!m_FreeLists[index]) {
+			refill(index);
+		}
+
+		FreeBlock* block = m_FreeLists[index];
+		m_FreeLists[index] = block->next;
+
+		m_Stats.bytes_in_use += (index + 1) * SIZE_CLASS_GRANULARITY;
+		m_Stats.peak_bytes_in_use = std::max(m_Stats.peak_bytes_in_use, m_Stats.bytes_in_use);
+		return block;
+	}
+
+	void SlabAllocator::free(void* memory, size_t size)
+	{
+		m_Stats.frees++;
+
+		if (size > MAX_SMALL_SIZE) {
+			m_Stats.bytes_in_use -= size;
+
+			LargeBlock* block = (LargeBlock*)((char*)memory - LARGE_HEADER_SIZE);
+			if (block->previous) {
+				block->previous->next = block->next;
+			}
+			else {
+				m_LargeBlocks = block->next;
+			}
+			if (block->next) {
+				block->next->previous = block->previous;
+			}
+			::operator delete(block);
+			return;
+		}
+
+		size_t index = size_class(size);
+		FreeBlock* block = (FreeBlock*)memory;
+		block->next = m_FreeLists[index];
+		m_FreeLists[index] = block;
+
+		m_Stats.bytes_in_use -= (index + 1) * SIZE_CLASS_GRANULARITY;
+	}
+
+	const AllocatorStats& SlabAllocator::stats() const
+	{
+		return m_Stats;
+	}
+
+	size_t SlabAllocator::size_class(size_t size)
+	{
+		// sizes 1 to 16 are class 0, 17 to 32 class 1 and so on
+		return (std::max<size_t>(size, 1) - 1) / SIZE_CLASS_GRANULARITY;
+	}
+
+	void SlabAllocator::refill(size_t size_class)
+	{
+		// operator new aligns the slab for any object, and the block size keeps
+		// every block after the first aligned too
+		size_t block_size = (size_class + 1) * SIZE_CLASS_GRANULARITY;
+		char* slab = (char*)::operator new(SLAB_SIZE);
+		m_Slabs.push_back(slab);
+		m_Stats.slabs++;
+
+		// thread the blocks in address order, so they are handed out that way
+		FreeBlock* head = nullptr;
+		for (size_t offset = (SLAB_SIZE / block_size) * block_size; offset > 0;) {
+			offset -= block_size;
+			FreeBlock* block = (FreeBlock*)(slab + offset);
+			block->next = head;
+			head = block;
+		}
+
+		m_FreeLists[size_class] = head;
+	}
+
+}
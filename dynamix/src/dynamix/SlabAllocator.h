@@ -0,0 +1,71 @@
+#pragma once
+
+#include <vector>
+#include <cstddef>
+
+namespace dynamix {
+
+	struct AllocatorStats
+	{
+		size_t allocations = 0;
+		size_t large_allocations = 0; // too big for a size class, passed on to operator new
+		size_t frees = 0;
+		size_t slabs = 0;
+		size_t bytes_in_use = 0;      // rounded up to the size class
+		size_t peak_bytes_in_use = 0;
+	};
+
+	// Hands out the memory of heap objects. Sizes are rounded up to a multiple of
+	// SIZE_CLASS_GRANULARITY and every size class keeps a free list, which is
+	// refilled a whole slab at a time. Each object kind has a fixed header, so it
+	// lands in a class of its own, and short strings share the classes just above
+	// it. The slabs are only given back when the allocator is destroyed, together
+	// with any larger allocations that are still live.
+	class SlabAllocator
+	{
+	public:
+		static constexpr size_t SIZE_CLASS_GRANULARITY = 16;
+		static constexpr size_t MAX_SMALL_SIZE = 512;
+		static constexpr size_t SLAB_SIZE = 16 * 1024;
+
+		SlabAllocator() = default;
+		~SlabAllocator();
+
+		SlabAllocator(const SlabAllocator&) = delete;
+		SlabAllocator& operator=(const SlabAllocator&) = delete;
+
+		void* allocate(size_t size);
+		// `size` has to be the one the memory was allocated with
+		void free(void* memory, size_t size);
+
+		const AllocatorStats& stats() const;
+
+	private:
+		struct FreeBlock
+		{
+			FreeBlock* next;
+		};
+
+		// put in front of every allocation too large for a size class
+		struct LargeBlock
+		{
+			LargeBlock* previous;
+			LargeBlock* next;
+		};
+
+		static constexpr size_t LARGE_HEADER_SIZE = alignof(std::max_align_t);
+		static_assert(sizeof(LargeBlock) <= LARGE_HEADER_SIZE);
+
+		static constexpr size_t SIZE_CLASS_COUNT = MAX_SMALL_SIZE / SIZE_CLASS_GRANULARITY;
+
+		static size_t size_class(size_t size);
+		void refill(size_t size_class);
+
+	private:
+		FreeBlock* m_FreeLists[SIZE_CLASS_COUNT] = {};
+		std::vector<void*> m_Slabs;
+		LargeBlock* m_LargeBlocks = nullptr;
+		AllocatorStats m_Stats;
+	};
+
+}
@@ -2,15 +2,18 @@
 
 #include "Maybe.h"
 
+#include <memory>
 #include <vector>
 
 namespace dynamix {
 
-	template <typename T>
+	template <typename T, typename Allocator = std::allocator<T>>
 	class Stack
 	{
 	public:
 		Stack() = default;
+		explicit Stack(const Allocator& allocator)
+			: m_Data(allocator) {}
 		~Stack() = default;
 
 		void push(T value) {
@@ -71,7 +74,7 @@ namespace dynamix {
 		}
 
 	private:
-		std::vector<T> m_Data;
+		std::vector<T, Allocator> m_Data;
 	};
 
 }
@@ -2,14 +2,18 @@
 
 #include "Object.h"
 
+#include <cmath>
+
 namespace dynamix {
 
 	const char* value_type_to_string(ValueType value_type, ObjType* obj_type) {
 		switch (value_type) {
 			case ValueType::Number:    return "number";
+			case ValueType::Integer:   return "number";
 			case ValueType::Bool:      return "bool";
 			case ValueType::Character: return "char";
 			case ValueType::Null:      return "null";
+			case ValueType::Undefined: return "undefined";
 			case ValueType::Obj: {
 				if (!obj_type) {
 					__debugbreak();
@@ -18,6 +22,8 @@ namespace dynamix {
 				switch (*obj_type) {
 					case ObjType::Function: return "Function";
 					case ObjType::String: return "String";
+					case ObjType::Closure: return "Function";
+					case ObjType::Upvalue: return "Upvalue";
 				}
 			}
 		}
@@ -28,7 +34,7 @@ namespace dynamix {
 
     bool Value::is_object_type(ObjType type) const
     {
-		return is_object() && as.object->type == type;
+		return is_object() && as_object()->type == type;
     }
 
 	bool Value::is_function() const
@@ -41,13 +47,18 @@ namespace dynamix {
 		return is_object_type(ObjType::String);
 	}
 
+	bool Value::is_closure() const
+	{
+		return is_object_type(ObjType::Closure);
+	}
+
     ObjFunction* Value::as_function() const
 	{
 		if (!is_function()) {
 			return nullptr;
 		}
 
-		return (ObjFunction*)as.object;
+		return (ObjFunction*)as_object();
 	}
 
 	ObjString* Value::as_string() const
@@ -56,59 +67,125 @@ namespace dynamix {
 			return nullptr;
 		}
 
-		return (ObjString*)as.object;
+		return (ObjString*)as_object();
+	}
+
+	ObjClosure* Value::as_closure() const
+	{
+		if (!is_closure()) {
+			return nullptr;
+		}
+
+		return (ObjClosure*)as_object();
 	}
 
 	void Value::print(bool new_line) const
 	{
 		auto func = [&]() { return (new_line ? "\n" : ""); };
 
-		switch (type) {
-			case ValueType::Number:    std::cout << as.number << func(); break;
-			case ValueType::Bool:      std::cout << (as.boolean ? "true" : "false") << func(); break;
-			case ValueType::Character: std::cout << as.character << func(); break;
+		switch (get_type()) {
+			case ValueType::Number:    std::cout << as_number() << func(); break;
+			case ValueType::Integer:   std::cout << as_integer() << func(); break;
+			case ValueType::Bool:      std::cout << (as_bool() ? "true" : "false") << func(); break;
+			case ValueType::Character: std::cout << as_character() << func(); break;
 			case ValueType::Null:      std::cout << "null" << func(); break;
+			case ValueType::Undefined: std::cout << "undefined" << func(); break;
 			case ValueType::Obj: {
-				switch (as.object->type) {
+				switch (as_object()->type) {
 					case ObjType::Function:
 						std::cout << std::format("<fn {}>", (as_function()->name.empty() ? "<script>" : as_function()->name.c_str())) << func();
 						break;
 					case ObjType::String:
-						std::cout << as_string()->obj << func();
+						if (const ObjString* flat = as_string()->flat()) {
+							std::cout << flat->view() << func();
+						}
+						else {
+							std::cout << as_string()->text() << func();
+						}
+						break;
+					case ObjType::Closure:
+						Value((Obj*)as_closure()->function).print(new_line);
+						break;
+					case ObjType::Upvalue:
+						std::cout << "upvalue" << func();
 						break;
 				}
 			}
 		}
 	}
 	
+	bool Value::is_falsey() const
+	{
+		switch (get_type()) {
+			case ValueType::Number:    return as_number() == 0.0;
+			case ValueType::Integer:   return as_integer() == 0;
+			case ValueType::Bool:      return as_bool() == false;
+			case ValueType::Character: return as_character() == '0';
+			case ValueType::Null:      return true;
+			case ValueType::Undefined: return true;
+			case ValueType::Obj: {
+				switch (as_object()->type)
+				{
+					case ObjType::String: return as_string()->length == 0; break;
+					case ObjType::Function: return false;
+					case ObjType::Closure: return false;
+					case ObjType::Upvalue: return false;
+				}
+			}
+		}
+
+		// unreachable
+		__debugbreak();
+		return false;
+	}
+
 	bool Value::operator==(const Value& other) const
 	{
-		if (type != other.type) {
+		// an integer equals the double of the same value
+		if (is_numeric() && other.is_numeric() && get_type() != other.get_type()) {
+			return to_double() == other.to_double();
+		}
+
+		ValueType type = get_type();
+		if (type != other.get_type()) {
 			return false;
 		}
 
-		if (is_object() && as.object->type != other.as.object->type) {
+		if (is_object() && as_object()->type != other.as_object()->type) {
 			return false;
 		}
 
 		switch (type)
 		{
-			case ValueType::Number:    return as.number == other.as.number;
-			case ValueType::Bool:      return as.boolean == other.as.boolean;
-			case ValueType::Character: return as.character == other.as.character;
+			case ValueType::Number:    return as_number() == other.as_number();
+			case ValueType::Integer:   return as_integer() == other.as_integer();
+			case ValueType::Bool:      return as_bool() == other.as_bool();
+			case ValueType::Character: return as_character() == other.as_character();
 			case ValueType::Null:      return true;
+			case ValueType::Undefined: return true;
 			case ValueType::Obj: {
-				switch (as.object->type)
+				switch (as_object()->type)
 				{
 					case ObjType::String: {
-						std::string lhs = as_string()->obj;
-						std::string rhs = other.as_string()->obj;
-						if (lhs.size() != rhs.size()) {
-							return false;
+						ObjString* lhs = as_string();
+						ObjString* rhs = other.as_string();
+
+						// flat strings are interned, ropes have to be compared by their text
+						// unless they have been flattened
+						const ObjString* lhs_flat = lhs->flat();
+						const ObjString* rhs_flat = rhs->flat();
+						if (lhs == rhs) {
+							return true;
 						}
 
-						return memcmp(lhs.data(), rhs.data(), lhs.size()) == 0;
+						if (lhs_flat && rhs_flat) {
+							return lhs_flat == rhs_flat;
+						}
+
+						return lhs->length == rhs->length && lhs->text() == rhs->text();
 					}
+					case ObjType::Closure: return as_object() == other.as_object();
+					case ObjType::Upvalue: return as_object() == other.as_object();
 					case ObjType::Function: {
 						ObjFunction* lhs = as_function();
 						ObjFunction* rhs = other.as_function();
@@ -133,4 +210,64 @@ namespace dynamix {
 		__debugbreak();
 		return false;
 	}
+
+	const char* arithmetic(ArithmeticOp op, Value a, Value b, Value* result)
+	{
+		bool integers = a.is(ValueType::Integer) && b.is(ValueType::Integer);
+		int64_t x = integers ? a.as_integer() : 0;
+		int64_t y = integers ? b.as_integer() : 0;
+		int64_t integer = 0;
+
+		switch (op) {
+			case ArithmeticOp::Add:
+				*result = integers && add_integers(x, y, &integer) ? Value(integer) : Value(a.to_double() + b.to_double());
+				return nullptr;
+			case ArithmeticOp::Sub:
+				*result = integers && subtract_integers(x, y, &integer) ? Value(integer) : Value(a.to_double() - b.to_double());
+				return nullptr;
+			case ArithmeticOp::Mul:
+				*result = integers && multiply_integers(x, y, &integer) ? Value(integer) : Value(a.to_double() * b.to_double());
+				return nullptr;
+			case ArithmeticOp::Div:
+				*result = integers && divide_integers(x, y, &integer) ? Value(integer) : Value(a.to_double() / b.to_double());
+				return nullptr;
+			case ArithmeticOp::Mod:
+				// the remainder takes the sign of the dividend, like fmod
+				if (integers && y != 0) {
+					*result = Value(y == -1 ? (int64_t)0 : x % y);
+				}
+				else {
+					*result = Value(std::fmod(a.to_double(), b.to_double()));
+				}
+				return nullptr;
+			default:
+				break;
+		}
+
+		if (!integers) {
+			return "is only defined for integers";
+		}
+
+		switch (op) {
+			case ArithmeticOp::BitAnd: *result = Value(x & y); return nullptr;
+			case ArithmeticOp::BitOr:  *result = Value(x | y); return nullptr;
+			case ArithmeticOp::BitXor: *result = Value(x ^ y); return nullptr;
+			default:
+				break;
+		}
+
+		// shifting drops the bits moved past the width of an integer
+		if (y < 0) {
+			return "got a negative shift count";
+		}
+
+		if (op == ArithmeticOp::ShiftLeft) {
+			*result = Value(y >= (int64_t)INTEGER_BITS ? (int64_t)0 : wrap_integer((uint64_t)x << y));
+		}
+		else {
+			*result = Value(y >= (int64_t)INTEGER_BITS ? (x < 0 ? (int64_t)-1 : (int64_t)0) : x >> y);
+		}
+
+		return nullptr;
+	}
 }
@@ -2,31 +2,165 @@
 
 #include <iostream>
 #include <format>
+#include <cstdint>
+#include <cstring>
 
 namespace dynamix {
 
+	// When enabled every Value is a single 64-bit word: numbers are stored as plain
+	// doubles and every other type hides in the payload of a quiet NaN. Disabled by
+	// default since the tagged union is much easier to inspect in a debugger.
+#ifndef NAN_BOXING
+#define NAN_BOXING 0
+#endif
+
 	enum class ValueType
 	{
-		Number,
+		Number,    // a double
+		Integer,
 		Bool,
 		Character,
 		Null,
 		Obj,
+		Undefined, // marks global slots that have not been defined yet
 	};
 
 	enum class ObjType;
 	typedef struct Obj Obj;
 	typedef struct ObjFunction ObjFunction;
 	typedef struct ObjString ObjString;
+	typedef struct ObjClosure ObjClosure;
+	typedef struct ObjUpvalue ObjUpvalue;
 
 	const char* value_type_to_string(ValueType value_type, ObjType* obj_type = nullptr);
 
+	// Width of script integers with either representation, the most a NaN boxed
+	// value has room for. Results that do not fit wrap or turn into doubles.
+	constexpr uint32_t INTEGER_BITS = 48;
+
+#if NAN_BOXING
+	struct Value
+	{
+		static constexpr uint64_t SIGN_BIT = 0x8000000000000000;
+		static constexpr uint64_t QNAN     = 0x7ffc000000000000;
+
+		static constexpr uint64_t TAG_NULL      = 1;
+		static constexpr uint64_t TAG_FALSE     = 2;
+		static constexpr uint64_t TAG_TRUE      = 3;
+		static constexpr uint64_t TAG_CHARACTER = 4;
+		static constexpr uint64_t TAG_UNDEFINED = 5;
+		static constexpr uint64_t TAG_MASK      = 7;
+		static constexpr uint64_t PAYLOAD_SHIFT = 3;
+
+		// integers are boxed like objects, with this bit set and the low 48 bits
+		// holding the two's complement value
+		static constexpr uint64_t INTEGER_BIT  = 0x0001000000000000;
+		static constexpr uint64_t INTEGER_MASK = 0x0000ffffffffffff;
+		static_assert(INTEGER_MASK == (1ull << INTEGER_BITS) - 1);
+
+		uint64_t bits;
+
+		Value() {
+			bits = QNAN | TAG_NULL;
+		}
+
+		Value(double number) {
+			memcpy(&bits, &number, sizeof(double));
+		}
+
+		Value(bool boolean) {
+			bits = QNAN | (boolean ? TAG_TRUE : TAG_FALSE);
+		}
+
+		Value(char character) {
+			bits = QNAN | ((uint64_t)(uint8_t)character << PAYLOAD_SHIFT) | TAG_CHARACTER;
+		}
+
+		Value(std::nullptr_t) {
+			bits = QNAN | TAG_NULL;
+		}
+
+		Value(Obj* object) {
+			bits = SIGN_BIT | QNAN | (uint64_t)(uintptr_t)object;
+		}
+
+		// `integer` must be in [INTEGER_MIN, INTEGER_MAX]
+		Value(int64_t integer) {
+			bits = SIGN_BIT | QNAN | INTEGER_BIT | ((uint64_t)integer & INTEGER_MASK);
+		}
+
+		static Value undefined() {
+			Value value;
+			value.bits = QNAN | TAG_UNDEFINED;
+			return value;
+		}
+
+		ValueType get_type() const {
+			if ((bits & QNAN) != QNAN) {
+				return ValueType::Number;
+			}
+
+			if ((bits & (SIGN_BIT | QNAN)) == (SIGN_BIT | QNAN)) {
+				return (bits & INTEGER_BIT) ? ValueType::Integer : ValueType::Obj;
+			}
+
+			switch (bits & TAG_MASK) {
+				case TAG_FALSE:
+				case TAG_TRUE:      return ValueType::Bool;
+				case TAG_CHARACTER: return ValueType::Character;
+				case TAG_UNDEFINED: return ValueType::Undefined;
+				default:            return ValueType::Null;
+			}
+		}
+
+		bool is(ValueType _type) const {
+			switch (_type) {
+				case ValueType::Number:    return (bits & QNAN) != QNAN;
+				case ValueType::Integer:   return (bits & (SIGN_BIT | QNAN | INTEGER_BIT)) == (SIGN_BIT | QNAN | INTEGER_BIT);
+				case ValueType::Bool:      return (bits | 1) == (QNAN | TAG_TRUE);
+				case ValueType::Character: return (bits & (SIGN_BIT | QNAN | TAG_MASK)) == (QNAN | TAG_CHARACTER);
+				case ValueType::Null:      return bits == (QNAN | TAG_NULL);
+				case ValueType::Obj:       return is_object();
+				case ValueType::Undefined: return bits == (QNAN | TAG_UNDEFINED);
+			}
+
+			return false;
+		}
+
+		bool is_object() const {
+			return (bits & (SIGN_BIT | QNAN | INTEGER_BIT)) == (SIGN_BIT | QNAN);
+		}
+
+		double as_number() const {
+			double number;
+			memcpy(&number, &bits, sizeof(double));
+			return number;
+		}
+
+		int64_t as_integer() const {
+			// shifting the sign of the payload into the top bit sign extends it
+			return (int64_t)(bits << (64 - INTEGER_BITS)) >> (64 - INTEGER_BITS);
+		}
+
+		bool as_bool() const {
+			return bits == (QNAN | TAG_TRUE);
+		}
+
+		char as_character() const {
+			return (char)(uint8_t)(bits >> PAYLOAD_SHIFT);
+		}
+
+		Obj* as_object() const {
+			return (Obj*)(uintptr_t)(bits & ~(SIGN_BIT | QNAN));
+		}
+#else
 	struct Value
 	{
 		ValueType type;
 		union
 		{
 			double number;
+			int64_t integer;
 			bool boolean;
 			char character;
 			Obj* object;
@@ -62,6 +196,22 @@ namespace dynamix {
 			as.object = object;
 		}
 
+		// `integer` must be in [INTEGER_MIN, INTEGER_MAX]
+		Value(int64_t integer) {
+			type = ValueType::Integer;
+			as.integer = integer;
+		}
+
+		static Value undefined() {
+			Value value;
+			value.type = ValueType::Undefined;
+			return value;
+		}
+
+		ValueType get_type() const {
+			return type;
+		}
+
 		bool is(ValueType _type) const {
 			return type == _type;
 		}
@@ -70,17 +220,162 @@ namespace dynamix {
 			return is(ValueType::Obj);
 		}
 
+		double as_number() const {
+			return as.number;
+		}
+
+		int64_t as_integer() const {
+			return as.integer;
+		}
+
+		bool as_bool() const {
+			return as.boolean;
+		}
+
+		char as_character() const {
+			return as.character;
+		}
+
+		Obj* as_object() const {
+			return as.object;
+		}
+#endif
+
+		static constexpr int64_t INTEGER_MAX = (int64_t)(UINT64_MAX >> (65 - INTEGER_BITS));
+		static constexpr int64_t INTEGER_MIN = -INTEGER_MAX - 1;
+
+		// integers and doubles are both numbers to scripts
+		bool is_numeric() const {
+			return is(ValueType::Integer) || is(ValueType::Number);
+		}
+
+		double to_double() const {
+			return is(ValueType::Integer) ? (double)as_integer() : as_number();
+		}
+
 		bool is_object_type(ObjType type) const;
 		bool is_function() const;
 		bool is_string() const;
+		bool is_closure() const;
 
 		ObjFunction* as_function() const;
 		ObjString* as_string() const;
+		ObjClosure* as_closure() const;
 
+		bool is_falsey() const;
 		void print(bool new_line) const;
 
 		bool operator==(const Value& other) const;
 	};
 
+	// Integer arithmetic for the interpreter's fast paths. Each returns false when the
+	// result is not an integer Value, for the caller to compute it in doubles instead.
+	inline bool fits_integer(int64_t integer)
+	{
+		return integer >= Value::INTEGER_MIN && integer <= Value::INTEGER_MAX;
+	}
+
+#if defined(__GNUC__) || defined(__clang__)
+	inline bool add_integers(int64_t a, int64_t b, int64_t* result)
+	{
+		return !__builtin_add_overflow(a, b, result) && fits_integer(*result);
+	}
+
+	inline bool subtract_integers(int64_t a, int64_t b, int64_t* result)
+	{
+		return !__builtin_sub_overflow(a, b, result) && fits_integer(*result);
+	}
+
+	inline bool multiply_integers(int64_t a, int64_t b, int64_t* result)
+	{
+		return !__builtin_mul_overflow(a, b, result) && fits_integer(*result);
+	}
+#else
+	inline bool add_integers(int64_t a, int64_t b, int64_t* result)
+	{
+		if ((b > 0 && a > Value::INTEGER_MAX - b) || (b < 0 && a < Value::INTEGER_MIN - b)) {
+			return false;
+		}
+
+		*result = a + b;
+		return true;
+	}
+
+	inline bool subtract_integers(int64_t a, int64_t b, int64_t* result)
+	{
+		if ((b < 0 && a > Value::INTEGER_MAX + b) || (b > 0 && a < Value::INTEGER_MIN + b)) {
+			return false;
+		}
+
+		*result = a - b;
+		return true;
+	}
+
+	inline bool multiply_integers(int64_t a, int64_t b, int64_t* result)
+	{
+		if (a == 0 || b == 0) {
+			*result = 0;
+			return true;
+		}
+
+		bool overflows = a > 0
+			? (b > 0 ? a > Value::INTEGER_MAX / b : b < Value::INTEGER_MIN / a)
+			: (b > 0 ? a < Value::INTEGER_MIN / b : a < Value::INTEGER_MAX / b);
+		if (overflows) {
+			return false;
+		}
+
+		*result = a * b;
+		return true;
+	}
+#endif
+
+	// keeps the low INTEGER_BITS bits of `bits` as a two's complement integer
+	inline int64_t wrap_integer(uint64_t bits)
+	{
+		return (int64_t)(bits << (64 - INTEGER_BITS)) >> (64 - INTEGER_BITS);
+	}
+
+	// only a division that leaves no remainder stays an integer
+	inline bool divide_integers(int64_t a, int64_t b, int64_t* result)
+	{
+		if (b == 0 || (a == Value::INTEGER_MIN && b == -1) || a % b != 0) {
+			return false;
+		}
+
+		*result = a / b;
+		return true;
+	}
+
+	enum class ArithmeticOp
+	{
+		Add,
+		Sub,
+		Mul,
+		Div,
+		Mod,
+		BitAnd,
+		BitOr,
+		BitXor,
+		ShiftLeft,
+		ShiftRight,
+	};
+
+	// Applies an arithmetic operator to two numbers the way the interpreter does:
+	// integers stay integers while the result fits, anything else is computed in
+	// doubles. Returns nullptr, or the end of an "operator '<op>' ..." error when
+	// the operator is not defined for them.
+	const char* arithmetic(ArithmeticOp op, Value a, Value b, Value* result);
+
+	// Compares two numbers, integers exactly and anything else as doubles.
+	inline bool less_than(Value a, Value b)
+	{
+		if (a.is(ValueType::Integer) && b.is(ValueType::Integer)) {
+			return a.as_integer() < b.as_integer();
+		}
+
+		return a.to_double() < b.to_double();
+	}
+
 
 }
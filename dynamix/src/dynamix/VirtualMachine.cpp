@@ -6,39 +6,31 @@
 #include "Compiler.h"
 #include "Disassembler.h"
 
-#include <sstream>
-#include <iomanip>
+#include <algorithm>
+#include <charconv>
 
 namespace dynamix {
 
-#define CALL_FRAME_CAPACITY 64
-#define STACK_CAPACITY (CALL_FRAME_CAPACITY * UINT8_MAX + 1)
-#define OBJECT_CAPACITY 256
+// room for every frame to use a short local window, plus one frame using all of LOCAL_CAPACITY
+#define STACK_CAPACITY (CALL_FRAME_CAPACITY * (UINT8_MAX + 1) + LOCAL_CAPACITY)
+// joining into a string at least this long makes a rope
+#define ROPE_MIN_LENGTH 64
 
-	VirtualMachine::VirtualMachine()
+	VirtualMachine::VirtualMachine(const CompilerOptions& options)
+		: m_CompilerOptions(options)
 	{
-		m_Stack.reserve(STACK_CAPACITY);
-		m_Frames.reserve(CALL_FRAME_CAPACITY);
-		m_Objects.reserve(OBJECT_CAPACITY);
+		m_Stack = new Value[STACK_CAPACITY];
+		m_StackTop = m_Stack;
 	}
 
 	VirtualMachine::~VirtualMachine()
 	{
-		const size_t obj_count = m_Objects.size();
-		for (size_t i = 0; i < obj_count; i++) {
-			Maybe<Obj*> value = m_Objects.pop();
-			if (!value.is_some()) {
-				continue;
-			}
-
-			Obj* obj = value.data();
-			delete obj;
-		}
+		delete[] m_Stack;
 	}
 
 	InterpretResult VirtualMachine::run_code(const std::string& filepath, const std::string& source)
 	{
-		Compiler compiler(filepath, source);
+		Compiler compiler(filepath, source, m_Heap, m_Globals, m_CompilerOptions);
 
 		ObjFunction* function = compiler.compile();
 		if (!function) {
@@ -48,15 +40,31 @@ namespace dynamix {
 			return InterpretResult::CompileError;
 		}
 
-		m_Stack.push(Value(function));
+		reset_stack();
+		*m_StackTop++ = Value((Obj*)function);
+
+		CallFrame* frame = &m_Frames[m_FrameCount++];
+		frame->function = function;
+		frame->closure = nullptr;
+		frame->ip = function->decoded.code.data();
+		frame->pc = function->registers.code.data();
+		frame->slots = m_Stack;
 
-		CallFrame frame;
-		frame.function = function;
-		frame.ip = function->block.bytes.data();
-		frame.slots = &m_Stack[0];
-		m_Frames.push(frame);
+		if (m_Heap.should_collect()) {
+			collect_garbage();
+		}
+
+		InterpretResult result;
+		if (m_CompilerOptions.backend == Backend::Register) {
+			// registers above the callee may still hold values of an earlier run
+			std::fill(m_Stack + 1, m_Stack + function->registers.register_count, Value(nullptr));
+			result = interpret_registers();
+		}
+		else {
+			result = interpret();
+		}
 
-		if (interpret() == InterpretResult::RuntimeError) {
+		if (result == InterpretResult::RuntimeError) {
 			std::cerr << std::format(
 				"thread 'main' panicked at: '{}'\n<{}:{}:{}> Runtime Error: {}\n",
 				m_LastError.source,
@@ -72,281 +80,1266 @@ namespace dynamix {
 		return InterpretResult::Ok;
 	}
 
-	InterpretResult VirtualMachine::interpret()
+	SEPARATE_DISPATCH InterpretResult VirtualMachine::interpret()
 	{
-		CallFrame* frame = &m_Frames[m_Frames.size() - 1];
+		CallFrame* frame = &m_Frames[m_FrameCount - 1];
+		DecodedInstruction* ip = frame->ip;
+		DecodedInstruction* code = frame->function->decoded.code.data();
+		DecodedInstruction* instruction = nullptr; // the one running, `ip` is already past it
+		Value* stack_top = m_StackTop;
+		Value* globals = m_Globals.values();
 
-#define READ_BYTE() (*frame->ip++)
-#define READ_SHORT() (frame->ip += 2, (uint16_t)((frame->ip[-2] << 8) | frame->ip[-1]))
-#define READ_CONSTANT() (frame->function->block.constants[READ_BYTE()])
-#define READ_STRING() (READ_CONSTANT().as_string())
+#define JUMP(target) (ip = code + (target))
+#define STORE_FRAME() (frame->ip = ip, m_StackTop = stack_top)
+#define POP() (*--stack_top)
+#define PEEK(distance) (stack_top[-1 - (distance)])
+#if CHECKED_STACK
+#define PUSH(value)\
+			do {\
+				if (stack_top == m_Stack + STACK_CAPACITY) {\
+					STORE_FRAME();\
+					runtime_error("stack overflow", frame);\
+					return InterpretResult::RuntimeError;\
+				}\
+				*stack_top++ = (value);\
+			} while (false)
+#else
+#define PUSH(value) (*stack_top++ = (value))
+#endif
 #define TYPE_MISMATCH(lhs, rhs, op)\
-			auto lhs_type = value_type_to_string(lhs.type, lhs.is_object() ? &lhs.as.object->type : nullptr);\
-			auto rhs_type = value_type_to_string(rhs.type, rhs.is_object() ? &rhs.as.object->type : nullptr);\
+			auto lhs_type = value_type_to_string(lhs.get_type(), lhs.is_object() ? &lhs.as_object()->type : nullptr);\
+			auto rhs_type = value_type_to_string(rhs.get_type(), rhs.is_object() ? &rhs.as_object()->type : nullptr);\
+			STORE_FRAME();\
 			runtime_error(std::format("operator '{}' not defined for types '{}' and '{}'", op, lhs_type, rhs_type), frame)
-#define BINARY_OP(op, op_char)\
+#if USE_QUICKENING
+#define QUICKEN(quickened) (instruction->op = OpCode::quickened)
+#else
+#define QUICKEN(quickened) do { } while (false)
+#endif
+// integers stay integers while `integer_op` can represent the result, any other
+// numbers are computed as doubles; only operands that are both doubles quicken
+#define ARITHMETIC_OP(op, op_char, integer_op, quickened)\
+			do {\
+				Value b = PEEK(0);\
+				Value a = PEEK(1);\
+				int64_t result;\
+				if (a.is(ValueType::Integer) && b.is(ValueType::Integer) && integer_op(a.as_integer(), b.as_integer(), &result)) {\
+					stack_top--;\
+					PEEK(0) = Value(result);\
+				}\
+				else if (a.is(ValueType::Number) && b.is(ValueType::Number)) {\
+					QUICKEN(quickened);\
+					stack_top--;\
+					PEEK(0) = Value(a.as_number() op b.as_number());\
+				}\
+				else if (a.is_numeric() && b.is_numeric()) {\
+					stack_top--;\
+					PEEK(0) = Value(a.to_double() op b.to_double());\
+				}\
+				else {\
+					TYPE_MISMATCH(a, b, op_char);\
+					return InterpretResult::RuntimeError;\
+				}\
+			} while (false)
+#define COMPARISON_OP(comparison, op_str, quickened)\
+			do {\
+				Value b = PEEK(0);\
+				Value a = PEEK(1);\
+				if (a.is(ValueType::Integer) && b.is(ValueType::Integer)) {\
+					int64_t x = a.as_integer();\
+					int64_t y = b.as_integer();\
+					stack_top--;\
+					PEEK(0) = Value(comparison);\
+				}\
+				else if (a.is(ValueType::Number) && b.is(ValueType::Number)) {\
+					QUICKEN(quickened);\
+					double x = a.as_number();\
+					double y = b.as_number();\
+					stack_top--;\
+					PEEK(0) = Value(comparison);\
+				}\
+				else if (a.is_numeric() && b.is_numeric()) {\
+					double x = a.to_double();\
+					double y = b.to_double();\
+					stack_top--;\
+					PEEK(0) = Value(comparison);\
+				}\
+				else {\
+					TYPE_MISMATCH(a, b, op_str);\
+					return InterpretResult::RuntimeError;\
+				}\
+			} while (false)
+// % and the bitwise operators run `expression` on integers `x` and `y` when
+// `condition` holds, anything else goes through `arithmetic`
+#define INTEGER_OP(expression, condition, op, op_str)\
+			do {\
+				Value b = PEEK(0);\
+				Value a = PEEK(1);\
+				if (a.is(ValueType::Integer) && b.is(ValueType::Integer)) {\
+					int64_t x = a.as_integer();\
+					int64_t y = b.as_integer();\
+					if (condition) {\
+						stack_top--;\
+						PEEK(0) = Value((int64_t)(expression));\
+						DISPATCH();\
+					}\
+				}\
+				if (!a.is_numeric() || !b.is_numeric()) {\
+					TYPE_MISMATCH(a, b, op_str);\
+					return InterpretResult::RuntimeError;\
+				}\
+				Value result;\
+				if (const char* error = arithmetic(ArithmeticOp::op, a, b, &result)) {\
+					STORE_FRAME();\
+					runtime_error(std::format("operator '{}' {}", op_str, error), frame);\
+					return InterpretResult::RuntimeError;\
+				}\
+				stack_top--;\
+				PEEK(0) = result;\
+			} while (false)
+// the compiler proved both operands are numbers
+#define UNCHECKED_ARITHMETIC_OP(op, integer_op)\
+			do {\
+				Value b = POP();\
+				Value a = PEEK(0);\
+				int64_t result;\
+				if (a.is(ValueType::Integer) && b.is(ValueType::Integer) && integer_op(a.as_integer(), b.as_integer(), &result)) {\
+					PEEK(0) = Value(result);\
+				}\
+				else {\
+					PEEK(0) = Value(a.to_double() op b.to_double());\
+				}\
+			} while (false)
+#define UNCHECKED_COMPARISON_OP(comparison)\
+			do {\
+				Value b = POP();\
+				Value a = PEEK(0);\
+				if (a.is(ValueType::Integer) && b.is(ValueType::Integer)) {\
+					int64_t x = a.as_integer();\
+					int64_t y = b.as_integer();\
+					PEEK(0) = Value(comparison);\
+				}\
+				else {\
+					double x = a.to_double();\
+					double y = b.to_double();\
+					PEEK(0) = Value(comparison);\
+				}\
+			} while (false)
+// a quickened instruction whose operands are not both doubles anymore goes back
+// to its generic form and runs again as that
+#define NUMBER_OP(expression, generic)\
 			do {\
-				if (peek(1).type != peek().type) {\
-					TYPE_MISMATCH(peek(1), peek(), op_char);\
+				if (!PEEK(1).is(ValueType::Number) || !PEEK(0).is(ValueType::Number)) {\
+					instruction->op = OpCode::generic;\
+					ip--;\
+					DISPATCH();\
+				}\
+				double b = POP().as_number();\
+				double a = PEEK(0).as_number();\
+				PEEK(0) = Value(expression);\
+			} while (false)
+#define COMPARE_JUMP(condition, op_str)\
+			do {\
+				Value a = frame->slots[instruction->a];\
+				Value b = *instruction->constant;\
+				if (a.is(ValueType::Integer) && b.is(ValueType::Integer)) {\
+					int64_t x = a.as_integer();\
+					int64_t y = b.as_integer();\
+					if (condition) {\
+						JUMP(instruction->b);\
+					}\
+				}\
+				else if (a.is_numeric()) {\
+					double x = a.to_double();\
+					double y = b.to_double();\
+					if (condition) {\
+						JUMP(instruction->b);\
+					}\
+				}\
+				else {\
+					TYPE_MISMATCH(a, b, op_str);\
+					return InterpretResult::RuntimeError;\
+				}\
+			} while (false)
+#define DEFINE_GLOBAL(read_slot)\
+			do {\
+				uint32_t slot = (read_slot);\
+				if (!globals[slot].is(ValueType::Undefined)) {\
+					STORE_FRAME();\
+					runtime_error(std::format(\
+						"global variable '{}' has multiple definitions; multiple initialization",\
+						m_Globals.name_of(slot)->view()\
+					), frame);\
+					return InterpretResult::RuntimeError;\
+				}\
+				globals[slot] = POP();\
+			} while (false)
+#define GET_GLOBAL(read_slot)\
+			do {\
+				uint32_t slot = (read_slot);\
+				if (globals[slot].is(ValueType::Undefined)) {\
+					std::string err = std::format("undefined variable '{}'", m_Globals.name_of(slot)->view());\
+					STORE_FRAME();\
+					runtime_error(err, frame);\
+					return InterpretResult::RuntimeError;\
+				}\
+				PUSH(globals[slot]);\
+			} while (false)
+#define SET_GLOBAL(read_slot)\
+			do {\
+				uint32_t slot = (read_slot);\
+				if (globals[slot].is(ValueType::Undefined)) {\
+					std::string err = std::format("undefined variable '{}'", m_Globals.name_of(slot)->view());\
+					STORE_FRAME();\
+					runtime_error(err, frame);\
+					return InterpretResult::RuntimeError;\
+				}\
+				globals[slot] = PEEK(0);\
+			} while (false)
+#define RESOLVE_CALLEE(callee, argc, function, closure)\
+			do {\
+				if (callee.is_closure()) {\
+					closure = callee.as_closure();\
+					function = closure->function;\
+				}\
+				else if (callee.is_function()) {\
+					closure = nullptr;\
+					function = callee.as_function();\
+				}\
+				else {\
+					STORE_FRAME();\
+					runtime_error("can only call functions", frame);\
+					return InterpretResult::RuntimeError;\
+				}\
+				if (function->arity != argc) {\
+					STORE_FRAME();\
+					runtime_error(std::format("expected {} arguments but got {}", function->arity, (uint32_t)argc), frame);\
 					return InterpretResult::RuntimeError;\
 				}\
-				switch (peek().type) {\
-					case ValueType::Number: {\
-						double b = m_Stack.pop().data().as.number;\
-						double a = m_Stack.pop().data().as.number;\
-						m_Stack.push(Value(a op b));\
-					} break;\
-					default:\
-						TYPE_MISMATCH(peek(1), peek(), op_char);\
-						return InterpretResult::RuntimeError;\
+			} while (false)
+// collecting once the closure is on the stack keeps the upvalues it just captured alive
+#define MAKE_CLOSURE(value)\
+			do {\
+				ObjFunction* function = (value).as_function();\
+				ObjClosure* closure = m_Heap.new_closure(function);\
+				for (const UpvalueCapture& capture : function->captures) {\
+					closure->upvalues.push_back(capture.is_local\
+						? capture_upvalue(frame->slots + capture.index)\
+						: frame->closure->upvalues[capture.index]);\
+				}\
+				PUSH(Value((Obj*)closure));\
+				if (m_Heap.should_collect()) {\
+					STORE_FRAME();\
+					collect_garbage();\
 				}\
 			} while (false)
 
 #if DEBUG_STACK_TRACE
+#define TRACE_INSTRUCTION()\
+			do {\
+				printf("          ");\
+				for (Value* slot = m_Stack; slot < stack_top; slot++) {\
+					printf("[ ");\
+					slot->print(false);\
+					printf(" ]");\
+				}\
+				printf("\n");\
+				Disassembler::disassemble_instruction(\
+					&frame->function->block,\
+					frame->function->decoded.offsets[ip - code]\
+				);\
+			} while (false)
+
 		printf("-- stack trace --\n");
+#else
+#define TRACE_INSTRUCTION() do { } while (false)
 #endif
-		for (;;) {
-#if DEBUG_STACK_TRACE
-			printf("          ");
-			for (size_t i = 0; i < m_Stack.size(); i++) {
-				const Value& slot = m_Stack[i];
-				printf("[ ");
-				slot.print(false);
-				printf(" ]");
-			}
-			printf("\n");
 
-			Disassembler::disassemble_instruction(
-				&frame->function->block,
-				(int32_t)(frame->ip - frame->function->block.bytes.data())
-			);
+		// With labels-as-values every handler ends in its own indirect jump, which
+		// gives the branch predictor one dispatch site per opcode instead of one
+		// shared switch. The table must list the handlers in OpCode order.
+#if USE_COMPUTED_GOTO
+		static void* dispatch_table[] = {
+			&&op_PushConstant,
+			&&op_PushConstantLong,
+			&&op_Pop,
+			&&op_Null,
+			&&op_True,
+			&&op_False,
+			&&op_Equal,
+			&&op_Greater,
+			&&op_Less,
+			&&op_NotEqual,
+			&&op_GreaterEqual,
+			&&op_LessEqual,
+			&&op_Add,
+			&&op_Sub,
+			&&op_Div,
+			&&op_Mul,
+			&&op_Mod,
+			&&op_BitAnd,
+			&&op_BitOr,
+			&&op_BitXor,
+			&&op_ShiftLeft,
+			&&op_ShiftRight,
+			&&op_Negate,
+			&&op_Not,
+			&&op_Jmp,
+			&&op_JmpLong,
+			&&op_Jz,
+			&&op_JzLong,
+			&&op_Loop,
+			&&op_LoopLong,
+			&&op_JumpIfFalsePop,
+			&&op_JumpIfFalsePopLong,
+			&&op_JumpIfTruePop,
+			&&op_JumpIfTruePopLong,
+			&&op_JumpIfNotLess,
+			&&op_JumpIfNotGreater,
+			&&op_JumpIfLess,
+			&&op_JumpIfGreater,
+			&&op_DefineGlobal,
+			&&op_DefineGlobalLong,
+			&&op_GetGlobal,
+			&&op_GetGlobalLong,
+			&&op_SetGlobal,
+			&&op_SetGlobalLong,
+			&&op_GetLocal,
+			&&op_GetLocalLong,
+			&&op_SetLocal,
+			&&op_SetLocalLong,
+			&&op_StoreLocalPop,
+			&&op_GetUpvalue,
+			&&op_SetUpvalue,
+			&&op_CloseUpvalue,
+			&&op_Closure,
+			&&op_ClosureLong,
+			&&op_Print,
+			&&op_Call,
+			&&op_TailCall,
+			&&op_Return,
+			&&op_GreaterUnchecked,
+			&&op_LessUnchecked,
+			&&op_GreaterEqualUnchecked,
+			&&op_LessEqualUnchecked,
+			&&op_AddUnchecked,
+			&&op_SubUnchecked,
+			&&op_DivUnchecked,
+			&&op_MulUnchecked,
+			&&op_PushZero,
+			&&op_PushOne,
+			&&op_GetLocal0,
+			&&op_GetLocal1,
+			&&op_GetLocal2,
+			&&op_GetLocal3,
+			&&op_SetLocal0,
+			&&op_SetLocal1,
+			&&op_SetLocal2,
+			&&op_SetLocal3,
+			&&op_IncLocal,
+			&&op_GreaterNumNum,
+			&&op_LessNumNum,
+			&&op_GreaterEqualNumNum,
+			&&op_LessEqualNumNum,
+			&&op_AddNumNum,
+			&&op_SubNumNum,
+			&&op_DivNumNum,
+			&&op_MulNumNum,
+		};
+
+#define INTERPRET_LOOP DISPATCH();
+#define CASE(name) op_##name
+#define DISPATCH()\
+			do {\
+				TRACE_INSTRUCTION();\
+				instruction = ip++;\
+				goto *dispatch_table[(uint8_t)instruction->op];\
+			} while (false)
+#else
+#define INTERPRET_LOOP\
+			dispatch:\
+			TRACE_INSTRUCTION();\
+			switch ((instruction = ip++)->op)
+#define CASE(name) case OpCode::name
+#define DISPATCH() goto dispatch
 #endif
 
-			switch (OpCode instruction = (OpCode)READ_BYTE()) {
-				case OpCode::PushConstant: {
-					Value constant = READ_CONSTANT();
-					if (constant.is_object()) {
-						m_Objects.push(constant.as.object);
-					}
+		INTERPRET_LOOP
+		{
+			// the long forms only differ in how wide their operands were encoded
+			CASE(PushConstant): CASE(PushConstantLong): PUSH(*instruction->constant); DISPATCH();
+			CASE(Pop): stack_top--; DISPATCH();
+			CASE(Null): PUSH(Value(nullptr)); DISPATCH();
+			CASE(True): PUSH(Value(true)); DISPATCH();
+			CASE(False): PUSH(Value(false)); DISPATCH();
+			CASE(Equal): {
+				Value b = flatten(POP());
+				PEEK(0) = Value(flatten(PEEK(0)) == b);
+				DISPATCH();
+			}
+			CASE(Greater): COMPARISON_OP(x > y, '>', GreaterNumNum); DISPATCH();
+			CASE(Less):    COMPARISON_OP(x < y, '<', LessNumNum);    DISPATCH();
+			CASE(NotEqual): {
+				Value b = flatten(POP());
+				PEEK(0) = Value(!(flatten(PEEK(0)) == b));
+				DISPATCH();
+			}
+			CASE(GreaterEqual): COMPARISON_OP(!(x < y), ">=", GreaterEqualNumNum); DISPATCH();
+			CASE(LessEqual):    COMPARISON_OP(!(x > y), "<=", LessEqualNumNum);    DISPATCH();
+			CASE(Add): {
+				Value b = PEEK(0);
+				Value a = PEEK(1);
+				int64_t result;
 
-					m_Stack.push(constant);
-				} break;
-				case OpCode::Pop: m_Stack.pop(); break;
-				case OpCode::Null: m_Stack.push(Value(nullptr)); break;
-				case OpCode::True: m_Stack.push(Value(true)); break;
-				case OpCode::False: m_Stack.push(Value(false)); break;
-				case OpCode::Equal: {
-					Value b = m_Stack.pop().data();
-					Value a = m_Stack.pop().data();
-					m_Stack.push(Value(a == b));
-				} break;
-				case OpCode::Greater: BINARY_OP(>, '>'); break;
-				case OpCode::Less:    BINARY_OP(<, '<'); break;
-				case OpCode::Add: {
-					auto error = [&]() {
-						TYPE_MISMATCH(peek(1), peek(), '+');
+				if (a.is(ValueType::Integer) && b.is(ValueType::Integer) && add_integers(a.as_integer(), b.as_integer(), &result)) {
+					stack_top--;
+					PEEK(0) = Value(result);
+				}
+				else if (a.is_string()) {
+					ObjString* result = concatenate(a, b);
+					if (!result) {
+						TYPE_MISMATCH(a, b, '+');
 						return InterpretResult::RuntimeError;
-					};
+					}
 
-					if (peek(1).is_string()) {
-						bool failed = false;
-						concatenate(failed);
+					stack_top--;
+					PEEK(0) = Value((Obj*)result);
 
-						if (failed) {
-							return error();
-						}
-					}
-					else if (peek(1).is(ValueType::Number) && peek().is(ValueType::Number)) {
-						double b = m_Stack.pop().data().as.number;
-						double a = m_Stack.pop().data().as.number;
-						m_Stack.push(Value(a + b));
-					}
-					else {
-						return error();
-					}
-				} break;
-				case OpCode::Sub:     BINARY_OP(-, '-'); break;
-				case OpCode::Mul:     BINARY_OP(*, '*'); break;
-				case OpCode::Div:     BINARY_OP(/, '/'); break;
-				case OpCode::Negate: {
-					if (!peek(0).is(ValueType::Number)) {
-						runtime_error("operand must be a number", frame);
-						return InterpretResult::RuntimeError;
+					if (m_Heap.should_collect()) {
+						STORE_FRAME();
+						collect_garbage();
 					}
+				}
+				else if (a.is(ValueType::Number) && b.is(ValueType::Number)) {
+					QUICKEN(AddNumNum);
+					stack_top--;
+					PEEK(0) = Value(a.as_number() + b.as_number());
+				}
+				else if (a.is_numeric() && b.is_numeric()) {
+					stack_top--;
+					PEEK(0) = Value(a.to_double() + b.to_double());
+				}
+				else {
+					TYPE_MISMATCH(a, b, '+');
+					return InterpretResult::RuntimeError;
+				}
+				DISPATCH();
+			}
+			CASE(Sub):        ARITHMETIC_OP(-, '-', subtract_integers, SubNumNum); DISPATCH();
+			CASE(Mul):        ARITHMETIC_OP(*, '*', multiply_integers, MulNumNum); DISPATCH();
+			CASE(Div):        ARITHMETIC_OP(/, '/', divide_integers, DivNumNum);   DISPATCH();
+			CASE(Mod):        INTEGER_OP(x % y, y != 0 && y != -1, Mod, '%'); DISPATCH();
+			CASE(BitAnd):     INTEGER_OP(x & y, true, BitAnd, '&'); DISPATCH();
+			CASE(BitOr):      INTEGER_OP(x | y, true, BitOr, '|'); DISPATCH();
+			CASE(BitXor):     INTEGER_OP(x ^ y, true, BitXor, '^'); DISPATCH();
+			CASE(ShiftLeft):  INTEGER_OP(wrap_integer((uint64_t)x << y), y >= 0 && y < INTEGER_BITS, ShiftLeft, "<<"); DISPATCH();
+			CASE(ShiftRight): INTEGER_OP(x >> y, y >= 0 && y < INTEGER_BITS, ShiftRight, ">>"); DISPATCH();
+			CASE(GreaterUnchecked):      UNCHECKED_COMPARISON_OP(x > y);                  DISPATCH();
+			CASE(LessUnchecked):         UNCHECKED_COMPARISON_OP(x < y);                  DISPATCH();
+			CASE(GreaterEqualUnchecked): UNCHECKED_COMPARISON_OP(!(x < y));               DISPATCH();
+			CASE(LessEqualUnchecked):    UNCHECKED_COMPARISON_OP(!(x > y));               DISPATCH();
+			CASE(AddUnchecked):          UNCHECKED_ARITHMETIC_OP(+, add_integers);        DISPATCH();
+			CASE(SubUnchecked):          UNCHECKED_ARITHMETIC_OP(-, subtract_integers);   DISPATCH();
+			CASE(DivUnchecked):          UNCHECKED_ARITHMETIC_OP(/, divide_integers);     DISPATCH();
+			CASE(MulUnchecked):          UNCHECKED_ARITHMETIC_OP(*, multiply_integers);   DISPATCH();
+			CASE(GreaterNumNum):      NUMBER_OP(a > b, Greater);         DISPATCH();
+			CASE(LessNumNum):         NUMBER_OP(a < b, Less);            DISPATCH();
+			CASE(GreaterEqualNumNum): NUMBER_OP(!(a < b), GreaterEqual); DISPATCH();
+			CASE(LessEqualNumNum):    NUMBER_OP(!(a > b), LessEqual);    DISPATCH();
+			CASE(AddNumNum):          NUMBER_OP(a + b, Add);             DISPATCH();
+			CASE(SubNumNum):          NUMBER_OP(a - b, Sub);             DISPATCH();
+			CASE(DivNumNum):          NUMBER_OP(a / b, Div);             DISPATCH();
+			CASE(MulNumNum):          NUMBER_OP(a * b, Mul);             DISPATCH();
+			CASE(Negate): {
+				Value a = PEEK(0);
+				if (!a.is_numeric()) {
+					STORE_FRAME();
+					runtime_error("operand must be a number", frame);
+					return InterpretResult::RuntimeError;
+				}
 
-					m_Stack.push(Value(-m_Stack.pop().data().as.number));
-				} break;
-				case OpCode::Not: m_Stack.push(Value(is_falsey(m_Stack.pop().data()))); break;
-				case OpCode::Jmp: {
-					uint16_t offset = READ_SHORT();
-					frame->ip += offset;
-				} break;
-				case OpCode::Jz: {
-					uint16_t offset = READ_SHORT();
-
-					if (is_falsey(peek())) {
-						frame->ip += offset;
-					}
-				} break;
-				case OpCode::Loop: {
-					uint16_t offset = READ_SHORT();
-					frame->ip -= offset;
-				} break;
-				case OpCode::DefineGlobal: {
-					ObjString* name = READ_STRING();
-					if (m_Globals.contains(name->obj)) {
-						runtime_error(std::format(
-							"global variable '{}' has multiple definitions; multiple initialization",
-							name->obj
-						), frame);
-						return InterpretResult::RuntimeError;
-					}
+				// the negation of the smallest integer does not fit one
+				if (a.is(ValueType::Integer) && a.as_integer() != Value::INTEGER_MIN) {
+					PEEK(0) = Value(-a.as_integer());
+				}
+				else {
+					PEEK(0) = Value(-a.to_double());
+				}
+				DISPATCH();
+			}
+			CASE(Not): PEEK(0) = Value(PEEK(0).is_falsey()); DISPATCH();
+			CASE(Jmp): CASE(JmpLong): CASE(Loop): CASE(LoopLong): JUMP(instruction->a); DISPATCH();
+			CASE(Jz): CASE(JzLong): {
+				if (PEEK(0).is_falsey()) {
+					JUMP(instruction->a);
+				}
+				DISPATCH();
+			}
+			CASE(JumpIfFalsePop): CASE(JumpIfFalsePopLong): {
+				if (POP().is_falsey()) {
+					JUMP(instruction->a);
+				}
+				DISPATCH();
+			}
+			CASE(JumpIfTruePop): CASE(JumpIfTruePopLong): {
+				if (!POP().is_falsey()) {
+					JUMP(instruction->a);
+				}
+				DISPATCH();
+			}
+			// the constant operand is always a number, checked by the compiler
+			CASE(JumpIfNotLess):    COMPARE_JUMP(!(x < y), '<');  DISPATCH();
+			CASE(JumpIfNotGreater): COMPARE_JUMP(!(x > y), '>');  DISPATCH();
+			CASE(JumpIfLess):       COMPARE_JUMP(x < y, ">=");    DISPATCH();
+			CASE(JumpIfGreater):    COMPARE_JUMP(x > y, "<=");    DISPATCH();
+			CASE(DefineGlobal): CASE(DefineGlobalLong): DEFINE_GLOBAL(instruction->a); DISPATCH();
+			CASE(GetGlobal):    CASE(GetGlobalLong):    GET_GLOBAL(instruction->a);    DISPATCH();
+			CASE(SetGlobal):    CASE(SetGlobalLong):    SET_GLOBAL(instruction->a);    DISPATCH();
+			CASE(GetLocal):     CASE(GetLocalLong):     PUSH(frame->slots[instruction->a]);          DISPATCH();
+			CASE(SetLocal):     CASE(SetLocalLong):     frame->slots[instruction->a] = PEEK(0);      DISPATCH();
+			CASE(StoreLocalPop):                        frame->slots[instruction->a] = POP();        DISPATCH();
+			CASE(PushZero):  PUSH(Value((int64_t)0));        DISPATCH();
+			CASE(PushOne):   PUSH(Value((int64_t)1));        DISPATCH();
+			CASE(GetLocal0): PUSH(frame->slots[0]);          DISPATCH();
+			CASE(GetLocal1): PUSH(frame->slots[1]);          DISPATCH();
+			CASE(GetLocal2): PUSH(frame->slots[2]);          DISPATCH();
+			CASE(GetLocal3): PUSH(frame->slots[3]);          DISPATCH();
+			CASE(SetLocal0): frame->slots[0] = PEEK(0);      DISPATCH();
+			CASE(SetLocal1): frame->slots[1] = PEEK(0);      DISPATCH();
+			CASE(SetLocal2): frame->slots[2] = PEEK(0);      DISPATCH();
+			CASE(SetLocal3): frame->slots[3] = PEEK(0);      DISPATCH();
+			CASE(IncLocal): {
+				Value* local = &frame->slots[instruction->a];
+				int64_t result;
+				if (local->is(ValueType::Integer) && add_integers(local->as_integer(), 1, &result)) {
+					*local = Value(result);
+				}
+				else {
+					*local = Value(local->to_double() + 1);
+				}
+				DISPATCH();
+			}
+			CASE(GetUpvalue): PUSH(*frame->closure->upvalues[instruction->a]->location);   DISPATCH();
+			CASE(SetUpvalue): *frame->closure->upvalues[instruction->a]->location = PEEK(0); DISPATCH();
+			CASE(CloseUpvalue): {
+				close_upvalues(stack_top - 1);
+				stack_top--;
+				DISPATCH();
+			}
+			CASE(Closure): CASE(ClosureLong): MAKE_CLOSURE(*instruction->constant); DISPATCH();
+			CASE(Print): flatten(POP()).print(true); DISPATCH();
+			CASE(Call): {
+				uint8_t argc = (uint8_t)instruction->a;
+				Value callee = PEEK(argc);
+				ObjFunction* function;
+				ObjClosure* closure;
+				RESOLVE_CALLEE(callee, argc, function, closure);
+
+				// the callee's window starts at the callee itself, its arguments are already in place
+				Value* window = stack_top - argc - 1;
+				if (m_FrameCount == CALL_FRAME_CAPACITY || window + function->decoded.max_depth > m_Stack + STACK_CAPACITY) {
+					STORE_FRAME();
+					runtime_error("stack overflow", frame);
+					return InterpretResult::RuntimeError;
+				}
+
+				frame->ip = ip;
+				frame = &m_Frames[m_FrameCount++];
+				frame->function = function;
+				frame->closure = closure;
+				frame->slots = window;
+
+				code = frame->function->decoded.code.data();
+				ip = code;
+				DISPATCH();
+			}
+			CASE(TailCall): {
+				uint8_t argc = (uint8_t)instruction->a;
+				Value callee = PEEK(argc);
+				ObjFunction* function;
+				ObjClosure* closure;
+				RESOLVE_CALLEE(callee, argc, function, closure);
+
+				if (frame->slots + function->decoded.max_depth > m_Stack + STACK_CAPACITY) {
+					STORE_FRAME();
+					runtime_error("stack overflow", frame);
+					return InterpretResult::RuntimeError;
+				}
+
+				// slide the callee and its arguments down over the returning frame and reuse it
+				close_upvalues(frame->slots);
+				Value* arguments = stack_top - argc - 1;
+				for (int32_t i = 0; i <= argc; i++) {
+					frame->slots[i] = arguments[i];
+				}
+				stack_top = frame->slots + argc + 1;
+				frame->function = function;
+				frame->closure = closure;
+
+				code = frame->function->decoded.code.data();
+				ip = code;
+				DISPATCH();
+			}
+			CASE(Return): {
+				Value result = POP();
+				close_upvalues(frame->slots);
+
+				if (--m_FrameCount == 0) {
+					m_StackTop = m_Stack;
+					return InterpretResult::Ok;
+				}
+
+				stack_top = frame->slots;
+				*stack_top++ = result;
+
+				frame = &m_Frames[m_FrameCount - 1];
+				ip = frame->ip;
+				code = frame->function->decoded.code.data();
+				DISPATCH();
+			}
+#if !USE_COMPUTED_GOTO
+			default: {
+				STORE_FRAME();
+				runtime_error(std::format(
+					"OpCode '{}' not implemented in virtual machine",
+					(uint32_t)instruction->op
+				), frame);
+				return InterpretResult::RuntimeError;
+			}
+#endif
+		}
+
+		// unreachable
+		return InterpretResult::RuntimeError;
+
+#undef DISPATCH
+#undef CASE
+#undef INTERPRET_LOOP
+#undef TRACE_INSTRUCTION
+#undef MAKE_CLOSURE
+#undef RESOLVE_CALLEE
+#undef SET_GLOBAL
+#undef GET_GLOBAL
+#undef DEFINE_GLOBAL
+#undef COMPARE_JUMP
+#undef NUMBER_OP
+#undef UNCHECKED_COMPARISON_OP
+#undef UNCHECKED_ARITHMETIC_OP
+#undef INTEGER_OP
+#undef COMPARISON_OP
+#undef ARITHMETIC_OP
+#undef QUICKEN
+#undef TYPE_MISMATCH
+#undef PUSH
+#undef PEEK
+#undef POP
+#undef STORE_FRAME
+#undef JUMP
+	}
+
+	SEPARATE_DISPATCH InterpretResult VirtualMachine::interpret_registers()
+	{
+		CallFrame* frame = &m_Frames[m_FrameCount - 1];
+		const RegisterInstruction* pc = frame->pc;
+		const RegisterInstruction* instruction = nullptr;
+		Value* slots = frame->slots;
+		Value* constants = frame->function->block.constants.data();
+		Value* globals = m_Globals.values();
+
+		// the collector scans the stack up to the end of the running frame's window
+#define STORE_FRAME() (frame->pc = pc, m_StackTop = slots + frame->function->registers.register_count)
+#define R(operand) (slots[(operand)])
+#define RK(operand) ((operand) & REGISTER_CONSTANT ? constants[(operand) & ~REGISTER_CONSTANT] : slots[(operand)])
+#define TYPE_MISMATCH(lhs, rhs, op)\
+			auto lhs_type = value_type_to_string(lhs.get_type(), lhs.is_object() ? &lhs.as_object()->type : nullptr);\
+			auto rhs_type = value_type_to_string(rhs.get_type(), rhs.is_object() ? &rhs.as_object()->type : nullptr);\
+			STORE_FRAME();\
+			runtime_error(std::format("operator '{}' not defined for types '{}' and '{}'", op, lhs_type, rhs_type), frame)
+#define ARITHMETIC_OP(op, op_char, integer_op)\
+			do {\
+				Value a = RK(instruction->b);\
+				Value b = RK(instruction->c);\
+				int64_t result;\
+				if (a.is(ValueType::Integer) && b.is(ValueType::Integer) && integer_op(a.as_integer(), b.as_integer(), &result)) {\
+					R(instruction->a) = Value(result);\
+				}\
+				else if (a.is_numeric() && b.is_numeric()) {\
+					R(instruction->a) = Value(a.to_double() op b.to_double());\
+				}\
+				else {\
+					TYPE_MISMATCH(a, b, op_char);\
+					return InterpretResult::RuntimeError;\
+				}\
+			} while (false)
+// evaluates `comparison` on `x` and `y` as integers or as doubles, then `then`
+#define COMPARE(a, b, comparison, op_str, then)\
+			do {\
+				if (a.is(ValueType::Integer) && b.is(ValueType::Integer)) {\
+					int64_t x = a.as_integer();\
+					int64_t y = b.as_integer();\
+					bool condition = comparison;\
+					then;\
+				}\
+				else if (a.is_numeric() && b.is_numeric()) {\
+					double x = a.to_double();\
+					double y = b.to_double();\
+					bool condition = comparison;\
+					then;\
+				}\
+				else {\
+					TYPE_MISMATCH(a, b, op_str);\
+					return InterpretResult::RuntimeError;\
+				}\
+			} while (false)
+#define COMPARISON_OP(comparison, op_str)\
+			do {\
+				Value a = RK(instruction->b);\
+				Value b = RK(instruction->c);\
+				COMPARE(a, b, comparison, op_str, R(instruction->a) = Value(condition));\
+			} while (false)
+#define COMPARE_JUMP(comparison, op_str)\
+			do {\
+				Value a = RK(instruction->a);\
+				Value b = RK(instruction->b);\
+				COMPARE(a, b, comparison, op_str, if (condition) pc = code + instruction->c);\
+			} while (false)
+#define INTEGER_OP(expression, condition, op, op_str)\
+			do {\
+				Value a = RK(instruction->b);\
+				Value b = RK(instruction->c);\
+				if (a.is(ValueType::Integer) && b.is(ValueType::Integer)) {\
+					int64_t x = a.as_integer();\
+					int64_t y = b.as_integer();\
+					if (condition) {\
+						R(instruction->a) = Value((int64_t)(expression));\
+						DISPATCH();\
+					}\
+				}\
+				if (!a.is_numeric() || !b.is_numeric()) {\
+					TYPE_MISMATCH(a, b, op_str);\
+					return InterpretResult::RuntimeError;\
+				}\
+				Value result;\
+				if (const char* error = arithmetic(ArithmeticOp::op, a, b, &result)) {\
+					STORE_FRAME();\
+					runtime_error(std::format("operator '{}' {}", op_str, error), frame);\
+					return InterpretResult::RuntimeError;\
+				}\
+				R(instruction->a) = result;\
+			} while (false)
+#define UNDEFINED_GLOBAL(slot)\
+			do {\
+				std::string err = std::format("undefined variable '{}'", m_Globals.name_of(slot)->view());\
+				STORE_FRAME();\
+				runtime_error(err, frame);\
+				return InterpretResult::RuntimeError;\
+			} while (false)
+#define RESOLVE_CALLEE(callee, argc, function, closure)\
+			do {\
+				if (callee.is_closure()) {\
+					closure = callee.as_closure();\
+					function = closure->function;\
+				}\
+				else if (callee.is_function()) {\
+					closure = nullptr;\
+					function = callee.as_function();\
+				}\
+				else {\
+					STORE_FRAME();\
+					runtime_error("can only call functions", frame);\
+					return InterpretResult::RuntimeError;\
+				}\
+				if (function->arity != argc) {\
+					STORE_FRAME();\
+					runtime_error(std::format("expected {} arguments but got {}", function->arity, argc), frame);\
+					return InterpretResult::RuntimeError;\
+				}\
+			} while (false)
+		// a new window may cover registers left behind by frames that already returned,
+		// their values are no longer traced and must not be seen by the collector
+#define ENTER_FUNCTION(callee, argc)\
+			do {\
+				std::fill(slots + (argc) + 1, slots + (callee)->registers.register_count, Value(nullptr));\
+				code = (callee)->registers.code.data();\
+				pc = code;\
+				constants = (callee)->block.constants.data();\
+			} while (false)
+
+		const RegisterInstruction* code = frame->function->registers.code.data();
+
+#if DEBUG_STACK_TRACE
+#define TRACE_INSTRUCTION()\
+			do {\
+				printf("          ");\
+				for (Value* slot = slots; slot < slots + frame->function->registers.register_count; slot++) {\
+					printf("[ ");\
+					slot->print(false);\
+					printf(" ]");\
+				}\
+				printf("\n");\
+				Disassembler::disassemble_register_instruction(\
+					&frame->function->registers,\
+					&frame->function->block,\
+					(int32_t)(pc - code)\
+				);\
+			} while (false)
 
-					m_Globals[name->obj] = peek();
-					m_Stack.pop();
-				} break;
-				case OpCode::GetGlobal: {
-					ObjString* name = READ_STRING();
-					if (!m_Globals.contains(name->obj)) {
-						std::string err = std::format("undefined variable '{}'", name->obj);
-						runtime_error(err, frame);
+		printf("-- register trace --\n");
+#else
+#define TRACE_INSTRUCTION() do { } while (false)
+#endif
+
+		// The table must list the handlers in RegisterOp order.
+#if USE_COMPUTED_GOTO
+		static void* dispatch_table[] = {
+			&&op_Move,
+			&&op_LoadNull,
+			&&op_LoadTrue,
+			&&op_LoadFalse,
+			&&op_Equal,
+			&&op_Greater,
+			&&op_Less,
+			&&op_NotEqual,
+			&&op_GreaterEqual,
+			&&op_LessEqual,
+			&&op_Add,
+			&&op_Sub,
+			&&op_Div,
+			&&op_Mul,
+			&&op_Mod,
+			&&op_BitAnd,
+			&&op_BitOr,
+			&&op_BitXor,
+			&&op_ShiftLeft,
+			&&op_ShiftRight,
+			&&op_Negate,
+			&&op_Not,
+			&&op_Jmp,
+			&&op_JumpIfFalse,
+			&&op_JumpIfTrue,
+			&&op_JumpIfNotLess,
+			&&op_JumpIfNotGreater,
+			&&op_JumpIfLess,
+			&&op_JumpIfGreater,
+			&&op_JumpIfEqual,
+			&&op_JumpIfNotEqual,
+			&&op_DefineGlobal,
+			&&op_GetGlobal,
+			&&op_SetGlobal,
+			&&op_GetUpvalue,
+			&&op_SetUpvalue,
+			&&op_CloseUpvalues,
+			&&op_Closure,
+			&&op_Print,
+			&&op_Call,
+			&&op_TailCall,
+			&&op_Return,
+		};
+
+#define INTERPRET_LOOP DISPATCH();
+#define CASE(name) op_##name
+#define DISPATCH()\
+			do {\
+				TRACE_INSTRUCTION();\
+				instruction = pc++;\
+				goto *dispatch_table[(uint8_t)instruction->op];\
+			} while (false)
+#else
+#define INTERPRET_LOOP\
+			dispatch:\
+			TRACE_INSTRUCTION();\
+			instruction = pc++;\
+			switch (instruction->op)
+#define CASE(name) case RegisterOp::name
+#define DISPATCH() goto dispatch
+#endif
+
+		INTERPRET_LOOP
+		{
+			CASE(Move):      R(instruction->a) = RK(instruction->b); DISPATCH();
+			CASE(LoadNull):  R(instruction->a) = Value(nullptr);     DISPATCH();
+			CASE(LoadTrue):  R(instruction->a) = Value(true);        DISPATCH();
+			CASE(LoadFalse): R(instruction->a) = Value(false);       DISPATCH();
+			CASE(Equal):     R(instruction->a) = Value(flatten(RK(instruction->b)) == flatten(RK(instruction->c)));    DISPATCH();
+			CASE(NotEqual):  R(instruction->a) = Value(!(flatten(RK(instruction->b)) == flatten(RK(instruction->c)))); DISPATCH();
+			CASE(Greater):      COMPARISON_OP(x > y, '>');     DISPATCH();
+			CASE(Less):         COMPARISON_OP(x < y, '<');     DISPATCH();
+			CASE(GreaterEqual): COMPARISON_OP(!(x < y), ">="); DISPATCH();
+			CASE(LessEqual):    COMPARISON_OP(!(x > y), "<="); DISPATCH();
+			CASE(Add): {
+				Value a = RK(instruction->b);
+				Value b = RK(instruction->c);
+				int64_t result;
+
+				if (a.is(ValueType::Integer) && b.is(ValueType::Integer) && add_integers(a.as_integer(), b.as_integer(), &result)) {
+					R(instruction->a) = Value(result);
+				}
+				else if (a.is_string()) {
+					ObjString* result = concatenate(a, b);
+					if (!result) {
+						TYPE_MISMATCH(a, b, '+');
 						return InterpretResult::RuntimeError;
 					}
 
-					Value value = m_Globals[name->obj];
-					m_Stack.push(value);
-				} break;
-				case OpCode::SetGlobal: {
-					ObjString* name = READ_STRING();
-					if (!m_Globals.contains(name->obj)) {
-						std::string err = std::format("undefined variable '{}'", name->obj);
-						runtime_error(err, frame);
-						return InterpretResult::RuntimeError;
+					R(instruction->a) = Value((Obj*)result);
+
+					if (m_Heap.should_collect()) {
+						STORE_FRAME();
+						collect_garbage();
 					}
+				}
+				else if (a.is_numeric() && b.is_numeric()) {
+					R(instruction->a) = Value(a.to_double() + b.to_double());
+				}
+				else {
+					TYPE_MISMATCH(a, b, '+');
+					return InterpretResult::RuntimeError;
+				}
+				DISPATCH();
+			}
+			CASE(Sub):        ARITHMETIC_OP(-, '-', subtract_integers); DISPATCH();
+			CASE(Mul):        ARITHMETIC_OP(*, '*', multiply_integers); DISPATCH();
+			CASE(Div):        ARITHMETIC_OP(/, '/', divide_integers);   DISPATCH();
+			CASE(Mod):        INTEGER_OP(x % y, y != 0 && y != -1, Mod, '%'); DISPATCH();
+			CASE(BitAnd):     INTEGER_OP(x & y, true, BitAnd, '&'); DISPATCH();
+			CASE(BitOr):      INTEGER_OP(x | y, true, BitOr, '|'); DISPATCH();
+			CASE(BitXor):     INTEGER_OP(x ^ y, true, BitXor, '^'); DISPATCH();
+			CASE(ShiftLeft):  INTEGER_OP(wrap_integer((uint64_t)x << y), y >= 0 && y < INTEGER_BITS, ShiftLeft, "<<"); DISPATCH();
+			CASE(ShiftRight): INTEGER_OP(x >> y, y >= 0 && y < INTEGER_BITS, ShiftRight, ">>"); DISPATCH();
+			CASE(Negate): {
+				Value a = RK(instruction->b);
+				if (!a.is_numeric()) {
+					STORE_FRAME();
+					runtime_error("operand must be a number", frame);
+					return InterpretResult::RuntimeError;
+				}
 
-					m_Globals[name->obj] = peek();
-				} break;
-				case OpCode::GetLocal: {
-					uint8_t slot = READ_BYTE();
-					m_Stack.push(frame->slots[slot]);
-				} break;
-				case OpCode::SetLocal: {
-					uint8_t slot = READ_BYTE();
-					frame->slots[slot] = peek();
-				} break;
-				case OpCode::Print: m_Stack.pop().data().print(true); break;
-				case OpCode::Return: return InterpretResult::Ok;
-				default: {
-					size_t opcode = frame->ip - frame->function->block.bytes.data() - 1;
+				if (a.is(ValueType::Integer) && a.as_integer() != Value::INTEGER_MIN) {
+					R(instruction->a) = Value(-a.as_integer());
+				}
+				else {
+					R(instruction->a) = Value(-a.to_double());
+				}
+				DISPATCH();
+			}
+			CASE(Not): R(instruction->a) = Value(RK(instruction->b).is_falsey()); DISPATCH();
+			CASE(Jmp): pc = code + instruction->a; DISPATCH();
+			CASE(JumpIfFalse): {
+				if (RK(instruction->a).is_falsey()) {
+					pc = code + instruction->b;
+				}
+				DISPATCH();
+			}
+			CASE(JumpIfTrue): {
+				if (!RK(instruction->a).is_falsey()) {
+					pc = code + instruction->b;
+				}
+				DISPATCH();
+			}
+			CASE(JumpIfNotLess):    COMPARE_JUMP(!(x < y), '<'); DISPATCH();
+			CASE(JumpIfNotGreater): COMPARE_JUMP(!(x > y), '>'); DISPATCH();
+			CASE(JumpIfLess):       COMPARE_JUMP(x < y, ">=");   DISPATCH();
+			CASE(JumpIfGreater):    COMPARE_JUMP(x > y, "<=");   DISPATCH();
+			CASE(JumpIfEqual): {
+				if (flatten(RK(instruction->a)) == flatten(RK(instruction->b))) {
+					pc = code + instruction->c;
+				}
+				DISPATCH();
+			}
+			CASE(JumpIfNotEqual): {
+				if (!(flatten(RK(instruction->a)) == flatten(RK(instruction->b)))) {
+					pc = code + instruction->c;
+				}
+				DISPATCH();
+			}
+			CASE(DefineGlobal): {
+				uint32_t slot = instruction->b;
+				if (!globals[slot].is(ValueType::Undefined)) {
+					STORE_FRAME();
 					runtime_error(std::format(
-						"OpCode '{}' not implemented in virtual machine",
-						opcode
+						"global variable '{}' has multiple definitions; multiple initialization",
+						m_Globals.name_of(slot)->view()
 					), frame);
 					return InterpretResult::RuntimeError;
 				}
+				globals[slot] = RK(instruction->a);
+				DISPATCH();
+			}
+			CASE(GetGlobal): {
+				uint32_t slot = instruction->b;
+				if (globals[slot].is(ValueType::Undefined)) {
+					UNDEFINED_GLOBAL(slot);
+				}
+				R(instruction->a) = globals[slot];
+				DISPATCH();
 			}
+			CASE(SetGlobal): {
+				uint32_t slot = instruction->b;
+				if (globals[slot].is(ValueType::Undefined)) {
+					UNDEFINED_GLOBAL(slot);
+				}
+				globals[slot] = RK(instruction->a);
+				DISPATCH();
+			}
+			CASE(GetUpvalue): R(instruction->a) = *frame->closure->upvalues[instruction->b]->location; DISPATCH();
+			CASE(SetUpvalue): *frame->closure->upvalues[instruction->b]->location = RK(instruction->a); DISPATCH();
+			CASE(CloseUpvalues): close_upvalues(slots + instruction->a); DISPATCH();
+			CASE(Closure): {
+				ObjFunction* function = constants[instruction->b].as_function();
+				ObjClosure* closure = m_Heap.new_closure(function);
+				for (const UpvalueCapture& capture : function->captures) {
+					closure->upvalues.push_back(capture.is_local
+						? capture_upvalue(slots + capture.index)
+						: frame->closure->upvalues[capture.index]);
+				}
+				R(instruction->a) = Value((Obj*)closure);
+
+				// the closure in its register keeps the upvalues it just captured alive
+				if (m_Heap.should_collect()) {
+					STORE_FRAME();
+					collect_garbage();
+				}
+				DISPATCH();
+			}
+			CASE(Print): flatten(RK(instruction->a)).print(true); DISPATCH();
+			CASE(Call): {
+				uint32_t argc = instruction->b;
+				Value callee = R(instruction->a);
+				ObjFunction* function;
+				ObjClosure* closure;
+				RESOLVE_CALLEE(callee, argc, function, closure);
+
+				// the callee's window starts at the callee itself, its arguments are already in place
+				Value* window = slots + instruction->a;
+				if (m_FrameCount == CALL_FRAME_CAPACITY || window + function->registers.register_count > m_Stack + STACK_CAPACITY) {
+					STORE_FRAME();
+					runtime_error("stack overflow", frame);
+					return InterpretResult::RuntimeError;
+				}
+
+				frame->pc = pc;
+				frame = &m_Frames[m_FrameCount++];
+				frame->function = function;
+				frame->closure = closure;
+				frame->slots = window;
+				slots = window;
+
+				ENTER_FUNCTION(function, argc);
+				DISPATCH();
+			}
+			CASE(TailCall): {
+				uint32_t argc = instruction->b;
+				Value callee = R(instruction->a);
+				ObjFunction* function;
+				ObjClosure* closure;
+				RESOLVE_CALLEE(callee, argc, function, closure);
+
+				if (slots + function->registers.register_count > m_Stack + STACK_CAPACITY) {
+					STORE_FRAME();
+					runtime_error("stack overflow", frame);
+					return InterpretResult::RuntimeError;
+				}
+
+				// move the callee and its arguments down over the returning frame and reuse it
+				close_upvalues(slots);
+				Value* arguments = slots + instruction->a;
+				for (uint32_t i = 0; i <= argc; i++) {
+					slots[i] = arguments[i];
+				}
+				frame->function = function;
+				frame->closure = closure;
+
+				ENTER_FUNCTION(function, argc);
+				DISPATCH();
+			}
+			CASE(Return): {
+				Value result = RK(instruction->a);
+				close_upvalues(slots);
+
+				if (--m_FrameCount == 0) {
+					m_StackTop = m_Stack;
+					return InterpretResult::Ok;
+				}
+
+				// the caller expects the result in the register that held the callee
+				slots[0] = result;
+
+				frame = &m_Frames[m_FrameCount - 1];
+				slots = frame->slots;
+				code = frame->function->registers.code.data();
+				pc = frame->pc;
+				constants = frame->function->block.constants.data();
+				DISPATCH();
+			}
+#if !USE_COMPUTED_GOTO
+			default: {
+				STORE_FRAME();
+				runtime_error(std::format(
+					"RegisterOp '{}' not implemented in virtual machine",
+					(uint32_t)instruction->op
+				), frame);
+				return InterpretResult::RuntimeError;
+			}
+#endif
 		}
 
-#undef BINARY_OP
+		// unreachable
+		return InterpretResult::RuntimeError;
+
+#undef DISPATCH
+#undef CASE
+#undef INTERPRET_LOOP
+#undef TRACE_INSTRUCTION
+#undef ENTER_FUNCTION
+#undef RESOLVE_CALLEE
+#undef UNDEFINED_GLOBAL
+#undef INTEGER_OP
+#undef COMPARE_JUMP
+#undef COMPARISON_OP
+#undef COMPARE
+#undef ARITHMETIC_OP
 #undef TYPE_MISMATCH
-#undef READ_STRING
-#undef READ_CONSTANT
-#undef READ_SHORT
-#undef READ_BYTE
+#undef RK
+#undef R
+#undef STORE_FRAME
 	}
 
-	Value VirtualMachine::peek(int32_t distance) const
+	void VirtualMachine::reset_stack()
 	{
-		return m_Stack[m_Stack.size() - 1 - distance];
+		m_StackTop = m_Stack;
+		m_FrameCount = 0;
+		m_OpenUpvalues = nullptr;
 	}
 
-	void VirtualMachine::reset_stack()
+	// ropes are compared and printed by their text, which is built the first time
+	// and then kept in the rope
+	Value VirtualMachine::flatten(Value value)
 	{
-		m_Stack.clear();
-		m_Frames.clear();
+		if (value.is_object()) {
+			m_Heap.flatten(value.as_object());
+		}
+
+		return value;
 	}
 
-	bool VirtualMachine::is_falsey(Value value) const
+	ObjString* VirtualMachine::concatenate(Value lhs, Value rhs)
 	{
-		switch (value.type) {
-			case ValueType::Number:    return value.as.number == 0.0;
-			case ValueType::Bool:      return value.as.boolean == false;
-			case ValueType::Character: return value.as.character == '0';
-			case ValueType::Null:      return true;
-			case ValueType::Obj: {
-				switch (value.as.object->type)
-				{
-					case ObjType::String: return value.as_string()->obj.empty(); break;
-				}
-			}
+		ObjString* left = lhs.as_string();
+		ObjString* right;
+
+		if (rhs.is_string()) {
+			right = rhs.as_string();
+		}
+		else if (rhs.is(ValueType::Character)) {
+			char character = rhs.as_character();
+			right = m_Heap.intern_string(std::string_view(&character, 1));
+		}
+		else if (rhs.is_numeric()) {
+			// formatted the way `print` shows numbers
+			char text[32];
+			std::to_chars_result result = rhs.is(ValueType::Integer)
+				? std::to_chars(text, text + sizeof(text), rhs.as_integer())
+				: std::to_chars(text, text + sizeof(text), rhs.as_number(), std::chars_format::general, 6);
+			right = m_Heap.intern_string(std::string_view(text, result.ptr - text));
+		}
+		else {
+			return nullptr;
 		}
 
-		// unreachable
-		__debugbreak();
-		return false;
+		// a short result is copied, so that most strings stay flat and interned
+		size_t length = left->length + right->length;
+		if (length >= ROPE_MIN_LENGTH || left->is_rope() || right->is_rope()) {
+			return m_Heap.new_rope(left, right);
+		}
+
+		char string[ROPE_MIN_LENGTH];
+		std::copy_n(left->chars(), left->length, string);
+		std::copy_n(right->chars(), right->length, string + left->length);
+		return m_Heap.intern_string(std::string_view(string, length));
 	}
 
-	void VirtualMachine::concatenate(bool& failed)
+	const AllocatorStats& VirtualMachine::allocator_stats() const
 	{
-		ObjString* result = new ObjString();
+		return m_Heap.allocator_stats();
+	}
 
-		if (peek().is_string()) {
-			ObjString* rhs = m_Stack.pop().data().as_string();
-			ObjString* lhs = m_Stack.pop().data().as_string();
+	void VirtualMachine::collect_garbage()
+	{
+		mark_roots();
+		m_Heap.trace_references();
+		m_Heap.sweep();
+	}
 
-			std::string string = lhs->obj;
-			remove_null_terminator(string);
-			std::string res = string + rhs->obj + '\0';
+	void VirtualMachine::mark_roots()
+	{
+		for (Value* slot = m_Stack; slot < m_StackTop; slot++) {
+			m_Heap.mark_value(*slot);
+		}
 
-			result->obj = res;
+		for (uint32_t i = 0; i < m_FrameCount; i++) {
+			m_Heap.mark_object(m_Frames[i].function);
+			m_Heap.mark_object(m_Frames[i].closure);
 		}
-		else if (peek().is(ValueType::Character)) {
-			char rhs = m_Stack.pop().data().as.character;
-			ObjString* lhs = m_Stack.pop().data().as_string();
 
-			std::string string = lhs->obj;
-			remove_null_terminator(string);
-			std::string res = string + rhs + '\0';
+		for (ObjUpvalue* upvalue = m_OpenUpvalues; upvalue; upvalue = upvalue->next_open) {
+			m_Heap.mark_object(upvalue);
+		}
 
-			result->obj = res;
+		Value* globals = m_Globals.values();
+		for (uint32_t slot = 0; slot < m_Globals.size(); slot++) {
+			m_Heap.mark_object(m_Globals.name_of(slot));
+			m_Heap.mark_value(globals[slot]);
 		}
-		else if (peek().is(ValueType::Number)) {
-			double rhs = m_Stack.pop().data().as.number;
-			ObjString* lhs = m_Stack.pop().data().as_string();
+	}
 
-			std::string string = lhs->obj;
-			remove_null_terminator(string);
-			std::stringstream ss;
-			ss << string << std::setw(1) << rhs << '\0';
-			std::string res = ss.str();
+	ObjUpvalue* VirtualMachine::capture_upvalue(Value* slot)
+	{
+		// the open list is sorted by slot, top of the stack first, and holds one upvalue per slot
+		ObjUpvalue* previous = nullptr;
+		ObjUpvalue* upvalue = m_OpenUpvalues;
+		while (upvalue && upvalue->location > slot) {
+			previous = upvalue;
+			upvalue = upvalue->next_open;
+		}
 
-			result->obj = res;
+		if (upvalue && upvalue->location == slot) {
+			return upvalue;
+		}
+
+		ObjUpvalue* created = m_Heap.new_upvalue(slot);
+		created->next_open = upvalue;
+
+		if (previous) {
+			previous->next_open = created;
 		}
 		else {
-			failed = true;
+			m_OpenUpvalues = created;
 		}
 
-		((Obj*)result)->type = ObjType::String;
-
-		m_Objects.push((Obj*)result);
-		m_Stack.push(Value((Obj*)result));
+		return created;
 	}
 
-	void VirtualMachine::remove_null_terminator(std::string& str)
+	void VirtualMachine::close_upvalues(Value* last)
 	{
-		while (size_t pos = str.find('\0')) {
-			if (pos == std::string::npos) {
-				return;
-			}
-
-			str.erase(pos);
+		while (m_OpenUpvalues && m_OpenUpvalues->location >= last) {
+			ObjUpvalue* upvalue = m_OpenUpvalues;
+			upvalue->closed = *upvalue->location;
+			upvalue->location = &upvalue->closed;
+			m_OpenUpvalues = upvalue->next_open;
 		}
 	}
 
 	void VirtualMachine::runtime_error(const std::string& error, const CallFrame* frame)
 	{
-		size_t instruction = frame->ip - frame->function->block.bytes.data() - 1;
-		uint32_t line = frame->function->block.lines[instruction];
+		uint32_t line;
+		if (m_CompilerOptions.backend == Backend::Register) {
+			line = frame->function->registers.lines[frame->pc - frame->function->registers.code.data() - 1];
+		}
+		else {
+			const DecodedBlock& decoded = frame->function->decoded;
+			line = frame->function->block.lines[decoded.offsets[frame->ip - decoded.code.data() - 1]];
+		}
+
 		//std::string source = m_Block->source_lines[line - 1];
 		std::string function_name;
 
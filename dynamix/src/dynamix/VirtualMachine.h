@@ -1,8 +1,12 @@
 #pragma once
 
 #include "ByteBlock.h"
+#include "Heap.h"
+#include "Globals.h"
+#include "Compiler.h"
 #include "Stack.h"
 #include "Value.h"
+#include "Object.h"
 
 #include <unordered_map>
 
@@ -24,42 +28,54 @@ namespace dynamix {
 		uint32_t line;
 	};
 
+#define CALL_FRAME_CAPACITY 256
+
 	struct CallFrame
 	{
 		ObjFunction* function;
-		uint8_t* ip;
+		ObjClosure* closure; // null when the function captures nothing
+		DecodedInstruction* ip;
+		const RegisterInstruction* pc; // used instead of `ip` by the register backend
 		Value* slots;
 	};
 
 	class VirtualMachine
 	{
 	public:
-		VirtualMachine();
+		VirtualMachine(const CompilerOptions& options = CompilerOptions());
 		~VirtualMachine();
 
 		InterpretResult run_code(const std::string& filepath, const std::string& source);
+		const AllocatorStats& allocator_stats() const;
 
 	private:
 		InterpretResult interpret();
+		InterpretResult interpret_registers();
 
-		Value peek(int32_t distance = 0) const;
 		void reset_stack();
-		bool is_falsey(Value value) const;
-		void concatenate(bool& failed);
-		void remove_null_terminator(std::string& str);
+		ObjString* concatenate(Value lhs, Value rhs);
+		Value flatten(Value value);
+		void collect_garbage();
+		void mark_roots();
+		ObjUpvalue* capture_upvalue(Value* slot);
+		void close_upvalues(Value* last);
 		void runtime_error(const std::string& error, const CallFrame* frame);
 
 	private:
 		/*uint8_t* m_Ip = nullptr;
 		ByteBlock* m_Block = nullptr;*/
 		
-		Stack<Value> m_Stack;
-		Stack<CallFrame> m_Frames;
-		Stack<Obj*> m_Objects;
+		Value* m_Stack = nullptr;
+		Value* m_StackTop = nullptr;
+		CallFrame m_Frames[CALL_FRAME_CAPACITY];
+		uint32_t m_FrameCount = 0;
+		ObjUpvalue* m_OpenUpvalues = nullptr;
+		Heap m_Heap;
 		
-		std::unordered_map<std::string, Value> m_Globals;
+		Globals m_Globals;
 
 		RuntimeError m_LastError;
+		CompilerOptions m_CompilerOptions;
 	};
 
 }
@@ -6,37 +6,119 @@
 #include <fstream>
 #include <string>
 #include <filesystem>
+#include <vector>
 
 namespace dynamix {
 
 #define DEBUG_STACK_TRACE 0
 #define DEBUG_DISASSEMBLE_CODE 1
-
-	static void repl();
-	static InterpretResult run(const std::string& filepath, const std::string& source);
-	static InterpretResult run_file(const std::string& filepath);
+#define DEBUG_STRESS_GC 0
+#define DEBUG_LOG_GC 0
+#define DEBUG_LOG_PASSES 0
+
+	// Debug builds bounds-check every push onto the operand stack and report an
+	// overflow as a runtime error; release builds trust the compiler's bookkeeping.
+#ifdef _DEBUG
+#define CHECKED_STACK 1
+#else
+#define CHECKED_STACK 0
+#endif
+
+	// Default backend when none is picked with --backend; 1 runs scripts on the
+	// register machine instead of the stack machine.
+#define USE_REGISTER_BACKEND 0
+
+	// The stack machine rewrites arithmetic and comparisons whose operands were
+	// numbers into forms that only check for numbers, and back when they are not.
+#define USE_QUICKENING 1
+
+#if defined(__GNUC__) || defined(__clang__)
+#define USE_COMPUTED_GOTO 1
+#else
+#define USE_COMPUTED_GOTO 0
+#endif
+
+	// Handlers of decoded instructions all end in the same dispatch code, which gcc
+	// would otherwise merge back into a single shared indirect jump.
+#if USE_COMPUTED_GOTO && !defined(__clang__)
+#define SEPARATE_DISPATCH __attribute__((optimize("no-crossjumping")))
+#else
+#define SEPARATE_DISPATCH
+#endif
+
+	static void repl(const CompilerOptions& options);
+	static InterpretResult run(const std::string& filepath, const std::string& source, const CompilerOptions& options);
+	static InterpretResult run_file(const std::string& filepath, const CompilerOptions& options);
 
 	static bool is_repl_mode = false;
+	static bool show_allocator_stats = false;
+
+	static void print_allocator_stats(const AllocatorStats& stats)
+	{
+		printf("-- allocator: %zu allocations (%zu too large for a size class), %zu frees, %zu slabs of %zu bytes\n",
+			stats.allocations, stats.large_allocations, stats.frees, stats.slabs, SlabAllocator::SLAB_SIZE);
+		printf("-- allocator: %zu bytes in use, %zu at peak\n", stats.bytes_in_use, stats.peak_bytes_in_use);
+	}
 
 	static void runtime_start(int argc, char* argv[])
 	{
-		if (argc == 1) {
-			repl();
+		CompilerOptions options;
+		std::vector<std::string> args;
+		bool has_optimization_level = false;
+
+#if USE_REGISTER_BACKEND
+		options.backend = Backend::Register;
+#endif
+
+		for (int i = 1; i < argc; i++) {
+			std::string arg = argv[i];
+			if (arg == "--no-peephole") {
+				options.peephole = false;
+			}
+			else if (arg == "--alloc-stats") {
+				show_allocator_stats = true;
+			}
+			else if (arg == "--backend=stack") {
+				options.backend = Backend::Stack;
+			}
+			else if (arg == "--backend=register") {
+				options.backend = Backend::Register;
+			}
+			else if (arg.size() == 3 && arg.starts_with("-O") && arg[2] >= '0' && arg[2] <= '2') {
+				options.optimization_level = arg[2] - '0';
+				has_optimization_level = true;
+			}
+			else if (arg.starts_with("-")) {
+				std::cout << std::format("Unknown option '{}'\n", arg);
+				return;
+			}
+			else {
+				args.push_back(arg);
+			}
 		}
-		else if (argc == 2) {
-			run_file(argv[1]);
+
+		// the IR passes only run when a function is lifted for the register machine
+		if (has_optimization_level && options.backend == Backend::Stack) {
+			std::cerr << "Warning: -O has no effect on the stack backend, use --backend=register\n";
+		}
+
+		if (args.empty()) {
+			repl(options);
+		}
+		else if (args.size() == 1) {
+			run_file(args[0], options);
 		}
 		else {
-			std::cout << "Usage: dynamix <script>\n";
+			std::cout << "Usage: dynamix [--no-peephole] [--alloc-stats] [--backend=stack|register] [-O0|-O1|-O2] <script>\n";
 		}
 
 		std::cin.get();
 	}
 
-	static void repl()
+	static void repl(const CompilerOptions& options)
 	{
 		is_repl_mode = true;
-		VirtualMachine vm;
+		VirtualMachine vm(options);
 
 		for (;;) {
 			printf(">> ");
@@ -46,13 +128,18 @@ namespace dynamix {
 		}
 	}
 
-	static InterpretResult run(const std::string& filepath, const std::string& source)
+	static InterpretResult run(const std::string& filepath, const std::string& source, const CompilerOptions& options)
 	{
-		VirtualMachine vm;
-		return vm.run_code(filepath, source);
+		VirtualMachine vm(options);
+		InterpretResult result = vm.run_code(filepath, source);
+		if (show_allocator_stats) {
+			print_allocator_stats(vm.allocator_stats());
+		}
+
+		return result;
 	}
 
-	static InterpretResult run_file(const std::string& filepath)
+	static InterpretResult run_file(const std::string& filepath, const CompilerOptions& options)
 	{
 		std::ifstream file(filepath);
 		if (!file.is_open()) {
@@ -67,7 +154,7 @@ namespace dynamix {
 		source.resize(file_size);
 		file.read(source.data(), file_size);
 
-		InterpretResult result = run(filepath, source);
+		InterpretResult result = run(filepath, source, options);
 		if (result == InterpretResult::Ok) {
 			printf("program exited successfully...");
 		}
@@ -0,0 +1,67 @@
+#!/usr/bin/env python3
+# Runs every script in this directory on each backend and compares what it
+# prints with the .out file next to it.
+#
+# usage: run_tests.py <path to dynamix>
+
+import pathlib
+import re
+import subprocess
+import sys
+
+BACKENDS = [
+    ["--backend=stack"],
+    ["--backend=register", "-O0"],
+    ["--backend=register", "-O2"],
+]
+
+# debug builds disassemble every function before running it
+DISASSEMBLY = re.compile(r"^(-- .* --|\d{4} +(\d+|\|) .*)$")
+EXITED = "program exited successfully..."
+
+# seconds a script gets, compiling included
+TIMEOUT = 30
+
+
+def program_output(dynamix, flags, script):
+    # run from the script's directory, so errors name it the same way wherever the tests are
+    result = subprocess.run([str(pathlib.Path(dynamix).resolve()), *flags, script.name], cwd=script.parent,
+        input="\n", capture_output=True, text=True, timeout=TIMEOUT)
+    output = result.stdout
+    if output.endswith(EXITED):
+        output = output[:-len(EXITED)]
+
+    # runtime errors are reported on stderr, after whatever the script printed
+    output = "".join(line for line in output.splitlines(keepends=True) if not DISASSEMBLY.match(line))
+    return output + result.stderr
+
+
+def main():
+    if len(sys.argv) != 2:
+        print("usage: run_tests.py <path to dynamix>")
+        return 2
+
+    dynamix = sys.argv[1]
+    failures = 0
+    for script in sorted(pathlib.Path(__file__).parent.glob("*.dyn")):
+        expected = script.with_suffix(".out").read_text()
+        for flags in BACKENDS:
+            try:
+                output = program_output(dynamix, flags, script)
+            except subprocess.TimeoutExpired:
+                failures += 1
+                print(f"FAIL {script.name} {' '.join(flags)} (timed out)")
+                continue
+
+            if output != expected:
+                failures += 1
+                print(f"FAIL {script.name} {' '.join(flags)}")
+                print(f"-- expected --\n{expected}-- got --\n{output}")
+            else:
+                print(f"ok   {script.name} {' '.join(flags)}")
+
+    return 1 if failures else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())